@@ -0,0 +1,45 @@
+#ifndef ACTION_CACHE_H
+#define ACTION_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief A local, content-addressed cache of built targets. Each entry is the
+ * file a target's recipes produced, keyed by a hash of everything the recipes
+ * depend on, so an outdated target whose inputs were seen before can be
+ * restored instead of built.
+ *
+ */
+class ActionCache {
+   public:
+    ActionCache(const std::string& directory, uintmax_t maxSize);
+
+    std::string key(const std::string& target,
+                    const std::vector<std::string>& recipes,
+                    const std::vector<std::string>& prereqs);
+    bool restore(const std::string& key, const std::string& target);
+    void store(const std::string& key, const std::string& target);
+    void evict();
+
+    PRIVATE
+    /* Directory holding one file per entry, named by its key. */
+    std::string directory;
+
+    /* Total size in bytes that entries may take up. 0 if unlimited. */
+    uintmax_t maxSize;
+
+    /* The content hash of each file hashed so far, keyed by its path, size
+     * and modified time so a rewritten file is hashed again. */
+    std::unordered_map<std::string, std::string> contentHashes;
+
+    /* Guards `contentHashes`. */
+    std::mutex contentHashesMutex;
+
+    std::string contentHash(const std::string& path);
+};
+
+#endif  // ACTION_CACHE_H
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef CPU_QUOTA_H
+#define CPU_QUOTA_H
+
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Finds out how many CPUs this process may actually use, which in a
+ * container can be far fewer than the machine has, and where they are.
+ *
+ */
+namespace CpuQuota {
+size_t affinityCpus();
+std::vector<int> affinityCpuList();
+std::vector<int> parseCpuList(const std::string& cpuList);
+std::vector<std::vector<int>> numaNodes(
+    const std::string& root = "/sys/devices/system/node");
+std::optional<size_t> cgroupCpus(const std::string& root = "/sys/fs/cgroup",
+                                 const std::string& cgroup = "");
+size_t availableCpus();
+}  // namespace CpuQuota
+
+#endif  // CPU_QUOTA_H
\ No newline at end of file
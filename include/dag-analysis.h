@@ -0,0 +1,56 @@
+#ifndef DAG_ANALYSIS_H
+#define DAG_ANALYSIS_H
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "task-graph.h"
+
+/**
+ * @brief Static analysis of a task DAG without running it, to find out how
+ * much parallelism a build has and where it is lost. Each task is weighted by
+ * its recorded duration in seconds if durations are given, or else by 1.
+ *
+ */
+namespace DagAnalysis {
+struct Report {
+    size_t numNodes = 0;
+    size_t numEdges = 0;
+
+    /* The level of each task. Tasks without parents are at level 0, and any
+     * other task is one level above its highest parent. */
+    std::map<std::string, size_t> levels;
+
+    /* The number of tasks at each level. The widest level is the most tasks
+     * that can ever run at once, i.e. the largest useful number of jobs. */
+    std::vector<size_t> levelWidths;
+
+    /* The weight of each task. */
+    std::map<std::string, double> weights;
+
+    /* The heaviest chain of dependent tasks, first to last, and its weight.
+     * No number of jobs builds faster than this chain. */
+    std::vector<std::string> criticalPath;
+    double criticalPathWeight = 0;
+
+    /* The weight of all tasks. */
+    double totalWeight = 0;
+};
+
+Report analyze(const std::vector<TaskGraph::Task>& tasks,
+               const std::map<std::string, double>& durations = {});
+std::map<std::string, double> readDurations(const std::string& path);
+std::vector<std::vector<std::string>> shard(
+    const std::vector<TaskGraph::Task>& tasks,
+    const std::vector<std::string>& goals, size_t numShards,
+    const std::map<std::string, double>& durations = {});
+void writeText(std::ostream& out, const Report& report);
+void writeDot(std::ostream& out, const std::vector<TaskGraph::Task>& tasks,
+              const Report& report);
+void writeJson(std::ostream& out, const std::vector<TaskGraph::Task>& tasks,
+               const Report& report);
+}  // namespace DagAnalysis
+
+#endif  // DAG_ANALYSIS_H
\ No newline at end of file
@@ -0,0 +1,251 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief What running a recipe took. The CPU times, peak memory and context
+ * switches are those of the recipe's process and the children it waited for,
+ * as reported by `wait4`, and are only known for recipes run locally.
+ *
+ */
+struct ResourceUsage {
+    double wallSeconds = 0;
+    double userSeconds = 0;
+    double systemSeconds = 0;
+    long maxRssKilobytes = 0;
+    long voluntarySwitches = 0;
+    long involuntarySwitches = 0;
+};
+
+/**
+ * @brief A few threads that run posted work in the order it was posted, so
+ * the thread that posts it can get back to what it was doing right away. Work
+ * that is still queued when the queue is destroyed is run first.
+ *
+ */
+class WorkQueue {
+   public:
+    WorkQueue(size_t numThreads);
+    ~WorkQueue();
+    void post(std::function<void()> work);
+
+    PRIVATE
+    /* Work that no thread has picked up yet. */
+    std::deque<std::function<void()>> queue;
+
+    /* True once the threads are to stop. */
+    bool stopping = false;
+
+    /* Guards `queue` and `stopping`. */
+    std::mutex mutex;
+
+    /* Notified when work is posted or the threads are to stop. */
+    std::condition_variable posted;
+
+    std::vector<std::thread> threads;
+
+    void loop();
+};
+
+/**
+ * @brief Waits for any number of child processes from a single thread. Each
+ * child gets a pidfd, and one epoll instance watches all of them, so waiting
+ * does not tie up a thread per child. Exit handlers run on a few handler
+ * threads of the reactor's own, so a slow one holds up neither the reactor
+ * thread nor the others.
+ *
+ */
+class ProcessReactor {
+   public:
+    ProcessReactor(size_t numHandlers = 1);
+    ~ProcessReactor();
+    void watch(pid_t pid, std::function<void(int)> onExit,
+               ResourceUsage* usage = nullptr);
+
+    PRIVATE
+    /* Epoll instance that watches the pidfd of each child and `wakeFd`. */
+    int epollFd;
+
+    /* Event file that is written to stop the reactor thread. */
+    int wakeFd;
+
+    /* A watched child: its pid, exit handler and where to store its resource
+     * usage, if anywhere. */
+    struct Child {
+        pid_t pid;
+        std::function<void(int)> onExit;
+        ResourceUsage* usage;
+    };
+
+    /* Each watched child, keyed by its pidfd. */
+    std::unordered_map<int, Child> watched;
+
+    /* Guards `watched`. */
+    std::mutex mutex;
+
+    /* Threads that call the exit handlers of children that exited. */
+    WorkQueue handlers;
+
+    /* Thread that waits for children to exit and hands them to `handlers`. */
+    std::thread thread;
+
+    void loop();
+};
+
+/**
+ * @brief Runs expanded recipes with bash somewhere and passes their output on
+ * to this process's stdout and stderr.
+ *
+ */
+class Executor {
+   public:
+    virtual ~Executor() = default;
+
+    /* Returns the exit status of the recipe, or -1 after outputting an error
+     * message to std::cerr if it could not be run. Stores what the recipe
+     * took in `usage`, if given. */
+    virtual int run(const std::string& recipe,
+                    ResourceUsage* usage = nullptr) = 0;
+
+    /* Starts the recipe and returns right away. `onExit` is later called
+     * with what `run` would return, after `usage` is stored. It is called
+     * from one of the reactor's handler threads for a local executor with a
+     * reactor, from a thread of its own otherwise, and from the calling
+     * thread if the recipe could not be started locally. It may take its
+     * time, e.g. to start the next recipe, but holds up other handlers on
+     * the same thread. */
+    virtual void start(const std::string& recipe,
+                       std::function<void(int)> onExit,
+                       ResourceUsage* usage = nullptr);
+};
+
+/**
+ * @brief Runs recipes in a child process of this one. Started recipes are
+ * waited for by the reactor, if one is given. Recipes are pinned to the given
+ * CPUs, if any.
+ *
+ */
+class LocalExecutor : public Executor {
+   public:
+    LocalExecutor(std::shared_ptr<ProcessReactor> reactor = nullptr,
+                  std::vector<int> cpus = {})
+        : reactor(reactor), cpus(cpus){};
+    int run(const std::string& recipe, ResourceUsage* usage = nullptr) override;
+    void start(const std::string& recipe, std::function<void(int)> onExit,
+               ResourceUsage* usage = nullptr) override;
+
+    PRIVATE
+    std::shared_ptr<ProcessReactor> reactor;
+
+    /* CPUs that recipes may run on. Empty if they may run on any. */
+    std::vector<int> cpus;
+};
+
+/**
+ * @brief Runs recipes on a `minimake-worker` process, which may be on another
+ * machine that shares the file system. Holds one connection to the worker,
+ * so it runs one recipe at a time.
+ *
+ */
+class RemoteExecutor : public Executor {
+   public:
+    RemoteExecutor(const std::string& address) : address(address){};
+    ~RemoteExecutor();
+    int run(const std::string& recipe, ResourceUsage* usage = nullptr) override;
+
+    PRIVATE
+    /* Address of the worker, see `RemoteProtocol`. */
+    std::string address;
+
+    /* Connection to the worker. -1 until the first recipe is run. */
+    int fd = -1;
+};
+
+/**
+ * @brief A fixed set of executors that tasks borrow one at a time. Holds one
+ * local executor per job and one remote executor per worker address, so remote
+ * workers add capacity on top of the local jobs. Local executors are handed
+ * out first, and share one reactor. A pool that follows the CPU quota lends
+ * out no more local executors at once than there are CPUs available.
+ *
+ * With a placement, each local executor is pinned to a core or to the CPUs of
+ * a NUMA node, going round the nodes so jobs spread over all of them. A task
+ * then borrows an executor on the node where most of its parents ran if one
+ * is idle, so it finds their output in that node's caches and memory.
+ *
+ */
+class ExecutorPool {
+   public:
+    enum class Placement { None, Core, Numa };
+
+    ExecutorPool(size_t numJobs, const std::vector<std::string>& addresses,
+                 bool followCpuQuota = false,
+                 Placement placement = Placement::None);
+    size_t size() const;
+    void post(std::function<void()> work);
+    std::shared_ptr<Executor> acquire(
+        const std::string& task = "",
+        const std::vector<std::string>& parents = {});
+    std::unordered_map<std::string, int> getTaskNodes();
+
+    PRIVATE
+    bool isRemote(const Executor* executor) const;
+
+    /* Every executor in the pool. */
+    std::vector<std::unique_ptr<Executor>> executors;
+
+    /* Executors that are not borrowed, the next one to hand out last. */
+    std::vector<Executor*> idle;
+
+    /* The number of remote executors, which come first in `executors`. */
+    size_t numRemote;
+
+    /* The number of local executors that are borrowed, and that may be. */
+    size_t numLocalBorrowed = 0;
+    size_t localLimit;
+
+    /* Whether `localLimit` follows the CPU quota, and when it last did. */
+    bool followCpuQuota;
+    std::chrono::steady_clock::time_point quotaChecked;
+
+    /* The NUMA node of each placed executor. */
+    std::unordered_map<const Executor*, int> nodes;
+
+    /* The number of NUMA nodes that executors are placed on. */
+    size_t numNodes = 0;
+
+    /* The node that each task that was given a name last ran on. */
+    std::unordered_map<std::string, int> taskNodes;
+
+    /* Guards `idle`, `numLocalBorrowed`, `localLimit`, `quotaChecked` and
+     * `taskNodes`. */
+    std::mutex mutex;
+
+    /* Notified when an executor is returned. */
+    std::condition_variable returned;
+
+    /* Threads that run posted work, e.g. to start tasks. */
+    WorkQueue workQueue;
+};
+
+/**
+ * @brief The `minimake-worker` side of the remote protocol.
+ *
+ */
+namespace Worker {
+void serve(int fd);
+}  // namespace Worker
+
+#endif  // EXECUTOR_H
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef FILE_STATUS_H
+#define FILE_STATUS_H
+
+#include <time.h>
+
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Memoizes the last-modified time of files, so each file is looked up
+ * once per build no matter how many targets depend on it. Lookups can be
+ * batched ahead of time and are safe to do from many threads at once. Relative
+ * paths are looked up in the given directory, the working directory by
+ * default.
+ *
+ */
+class FileStatus {
+   public:
+    FileStatus(const std::string& directory = "");
+    ~FileStatus();
+    void prefetch(const std::vector<std::string>& paths);
+    std::optional<timespec> modifiedTime(const std::string& path);
+    void refresh(const std::string& path);
+
+    PRIVATE
+    /* The directory relative paths are looked up in, or AT_FDCWD. */
+    int directoryFd;
+
+    /* The last-modified time of each looked up path. Empty if the file does
+     * not exist or its status could not be read. */
+    std::unordered_map<std::string, std::optional<timespec>> modifiedTimes;
+
+    /* Guards `modifiedTimes`. */
+    std::shared_mutex mutex;
+};
+
+#endif  // FILE_STATUS_H
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -7,6 +9,60 @@
  *
  */
 namespace MakefileBuilder {
+/**
+ * @brief Optional build behavior chosen on the command line.
+ *
+ */
+struct Options {
+    /* Directory of the action cache. Empty if the cache is disabled. */
+    std::string cacheDirectory;
+
+    /* Total size in bytes the action cache may take up. 0 if unlimited. */
+    uintmax_t cacheSize = 0;
+
+    /* Addresses of `minimake-worker` processes. Each one runs one recipe at a
+     * time on top of the local jobs. */
+    std::vector<std::string> remoteAddresses;
+
+    /* File of recorded `target,seconds` durations that weight the targets
+     * in an analysis or a simulation. Empty if every target weighs the
+     * same. */
+    std::string durationsPath;
+
+    /* Whether the number of local jobs is sized to the CPUs available
+     * instead of given, and kept within the cgroup's CPU quota as it
+     * changes during the build. */
+    bool autoJobs = false;
+
+    /* How local jobs are pinned to CPUs: `core`, `numa`, or empty if they
+     * are not. */
+    std::string placement;
+
+    /* Which of how many shards of the build to run, counting from 1. 0 of 0
+     * if the whole build is run. */
+    size_t shardIndex = 0;
+    size_t numShards = 0;
+
+    /* How many of the slowest and hungriest targets to output at the end of
+     * a build. 0 if none. */
+    size_t profileCount = 0;
+
+    /* File that gets what the recipes of each target took, as CSV, or as
+     * JSON if its name ends with `.json`. Empty if none. */
+    std::string profilePath;
+
+    /* The only files changed since the last build, if they are known, see
+     * `MakefileParser::setChangedFiles`. */
+    std::optional<std::vector<std::string>> changedFiles;
+};
+
 void build(const std::string& makefilePath, std::vector<std::string> targets,
-           const size_t numJobs);
+           const size_t numJobs, const Options& options = {});
+void watch(const std::string& makefilePath, std::vector<std::string> targets,
+           const size_t numJobs, const Options& options = {});
+bool analyze(const std::string& makefilePath, std::vector<std::string> targets,
+             const std::string& format, const Options& options = {});
+bool simulate(const std::string& makefilePath,
+              std::vector<std::string> targets, const size_t numJobs,
+              const std::string& distribution, const Options& options = {});
 }  // namespace MakefileBuilder
\ No newline at end of file
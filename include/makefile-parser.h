@@ -1,24 +1,54 @@
 #include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "exception.h"
+#include "file-status.h"
+#include "makefile-snapshot.h"
+#include "restat-log.h"
 #include "variables.h"
 
 /**
  * @brief Parses a makefile and provides information about any target
- * that is needed to build it.
+ * that is needed to build it. Targets are looked up lazily, which adds to the
+ * parsed rules, so the parser is only used from one thread. Once the targets
+ * of a build are looked up, a `MakefileSnapshot` of them answers the queries
+ * of the tasks that build them.
  *
  */
-class MakefileParser {
+class MakefileParser : public std::enable_shared_from_this<MakefileParser> {
+    friend class MakefileSnapshot;
+
    public:
-    MakefileParser(std::string makefilePath);
+    MakefileParser(std::string makefilePath, std::string directory = "");
+    /* Target scopes point into the parser. */
+    MakefileParser(const MakefileParser&) = delete;
+    MakefileParser& operator=(const MakefileParser&) = delete;
 
     std::tuple<std::vector<std::string>, std::vector<size_t>> getRecipes(
         const std::string& target);
     std::vector<std::string> getPrereqs(const std::string& target);
-    bool outdated(const std::string& target);
+    std::vector<std::string> getOrderOnlyPrereqs(
+        const std::string& target) const;
+    bool isPhony(const std::string& target) const;
+    bool hasRecipes(const std::string& target);
+    std::vector<std::string> getGroup(const std::string& target) const;
+    void setChangedFiles(const std::vector<std::string>& files);
+    void prefetchFileStatus(const std::vector<std::string>& paths);
+    void refreshFileStatus(const std::string& path);
+    void clearFunctionCache();
+    std::shared_ptr<const MakefileSnapshot> snapshot(
+        const std::vector<std::string>& targets) const;
+    void saveRestatLog();
     std::vector<std::string> getFirstTargets();
+    std::string getPool(const std::string& target);
+    const std::string& getDirectory() const;
+    static const std::string& makeCommand();
+    std::map<std::string, size_t> getPoolDepths();
 
     class MakefileParserException : public PrintfException {
        public:
@@ -33,11 +63,19 @@ class MakefileParser {
     /* Path of the parsed makefile. */
     std::string makefilePath;
 
+    /* Directory that paths in the makefile are relative to. Empty for the
+     * working directory. */
+    std::string directory;
+
     /* The prerequisites for each target in the makefile. Targets with no
      * prerequisites are also stored, so the keys represent all parsed
      * makefile targets. */
     std::map<std::string, std::vector<std::string>> makefilePrereqs;
 
+    /* The prerequisites after a `|` for each target that has any. They must
+     * be built before the target, but do not make it outdated. */
+    std::map<std::string, std::vector<std::string>> makefileOrderOnlyPrereqs;
+
     /* The recipes for each target in the makefile. Only targets with
      * 1 or more recipes are stored. */
     std::map<std::string, std::vector<std::string>> makefileRecipes;
@@ -46,11 +84,104 @@ class MakefileParser {
      */
     std::map<std::string, std::vector<size_t>> makefileRecipeLinenos;
 
+    /* The targets of the `&:` rule that defined each grouped target. */
+    std::map<std::string, std::vector<std::string>> groupedTargets;
+
     /* Targets of the first rule defined in the makefile. */
     std::vector<std::string> firstTargets;
 
     /* Storage for all variable definitions. */
     Variables makefileVars;
 
+    /* The variables defined for each target by a `target: VAR = value` line.
+     * Each is a scope in front of `makefileVars`, holding only the target's
+     * own variables. */
+    std::map<std::string, Variables> targetVariables;
+
+    /* The remembered status of each file looked up while parsing or checking
+     * whether targets are outdated. Shared with snapshots. */
+    mutable FileStatus fileStatus;
+
+    /* A rule whose target contains the `%` wildcard. `%` matches any non-empty
+     * stem, which then replaces the `%` of each prerequisite pattern. */
+    struct PatternRule {
+        std::string targetPrefix;
+        std::string targetSuffix;
+        std::vector<std::string> prereqPatterns;
+        std::vector<std::string> orderOnlyPatterns;
+        std::vector<std::string> recipes;
+        std::vector<size_t> recipeLinenos;
+    };
+
+    /* Pattern rules in the order they were defined. */
+    std::vector<PatternRule> patternRules;
+
+    /* Pattern rules that share a target suffix, indexed by target prefix. */
+    struct PatternRuleBucket {
+        std::set<size_t> prefixLengths;
+        std::unordered_map<std::string, std::vector<size_t>> rulesByPrefix;
+    };
+
+    /* Pattern rules indexed by target suffix, then by target prefix, so that
+     * matching a target costs a lookup per distinct prefix and suffix length
+     * instead of a comparison per pattern rule. */
+    std::unordered_map<std::string, PatternRuleBucket> patternRuleIndex;
+    std::set<size_t> patternSuffixLengths;
+
+    /* The stem of each target whose recipes come from a pattern rule. */
+    std::map<std::string, std::string> makefileStems;
+
+    /* Targets that have already been looked up among the pattern rules. */
+    std::set<std::string> resolvedTargets;
+
+    /* Targets that are known not to depend on themselves. */
+    std::set<std::string> acyclicTargets;
+
+    /* The number of targets in each pool that may build at once. */
+    std::map<std::string, size_t> poolDepths;
+
+    /* The pool of each target that was assigned one. */
+    std::unordered_map<std::string, std::string> targetPools;
+
+    /* Targets whose recipes may leave them unmodified, see
+     * `MakefileSnapshot::restat`. */
+    std::set<std::string> restatTargets;
+
+    /* Targets named by `.PHONY`, which are never files. */
+    std::set<std::string> phonyTargets;
+
+    /* The only files changed since the last build, if they are known. Then
+     * no file is looked up to find out whether a target is outdated. */
+    std::optional<std::set<std::string>> changedFiles;
+
+    /* The targets that depend on a changed file, directly or through other
+     * targets, as of the last `prefetchFileStatus`. */
+    std::set<std::string> changedDependents;
+
+    /* The targets that each prerequisite, by its normalized path, is a
+     * prerequisite of. Built when the changed files are first looked for,
+     * and kept up to date as pattern rules are resolved. */
+    std::unordered_map<std::string, std::vector<std::string>> dependents;
+    bool dependentsIndexed = false;
+
+    /* The `.RESTAT` targets recorded as built as of an earlier time than their
+     * file's. Only loaded if there are any `.RESTAT` targets. Shared with
+     * snapshots. */
+    mutable RestatLog restatLog;
+
+    void parseMakefile(const std::string& makefilePath);
+    bool parseDepfile(const std::string& depfilePath);
+    void assignVariable(Variables& scope, const std::string& assignment,
+                        size_t lineno, const std::string& makefilePath);
+    void findChangedDependents();
+    void indexPrereq(const std::string& target, const std::string& prereq);
     bool hasCircularDependency(const std::string& target);
+    void addPatternRule(const std::string& targetPattern,
+                        const std::vector<std::string>& prereqPatterns,
+                        const std::vector<std::string>& orderOnlyPatterns = {});
+    std::optional<std::tuple<size_t, std::string>> matchPatternRule(
+        const std::string& target, size_t depth);
+    void resolvePatternRule(const std::string& target);
+    bool defined(const std::string& target);
+    std::string resolve(const std::string& path) const;
 };
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef MAKEFILE_SNAPSHOT_H
+#define MAKEFILE_SNAPSHOT_H
+
+#include <time.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "file-status.h"
+#include "restat-log.h"
+#include "variables.h"
+
+class MakefileParser;
+
+/**
+ * @brief A frozen, read-only copy of what a parsed makefile says about a set of
+ * targets, taken once they are all looked up. Targets are kept in one vector
+ * sorted by name and found by binary search, and nothing is added to it after
+ * it is taken, so any number of threads can query it at once without locking.
+ * File statuses and the restat log are shared with the parser, and are
+ * synchronized on their own.
+ *
+ */
+class MakefileSnapshot {
+   public:
+    MakefileSnapshot(std::shared_ptr<const MakefileParser> owner,
+                     const std::vector<std::string>& targets);
+    MakefileSnapshot(const MakefileSnapshot&) = delete;
+    MakefileSnapshot& operator=(const MakefileSnapshot&) = delete;
+
+    std::tuple<std::vector<std::string>, std::vector<size_t>> expandRecipes(
+        const std::string& target) const;
+    const std::vector<std::string>& getPrereqs(const std::string& target) const;
+    std::vector<std::string> getGroup(const std::string& target) const;
+    bool isPhony(const std::string& target) const;
+    bool outdated(const std::string& target) const;
+    void refreshFileStatus(const std::string& path) const;
+    std::optional<timespec> modifiedTime(const std::string& path) const;
+    void restat(const std::string& target,
+                std::optional<timespec> modifiedBefore) const;
+    const std::string& getDirectory() const;
+
+    PRIVATE
+    /* What the makefile says about one target. */
+    struct Entry {
+        std::string target;
+        std::vector<std::string> prereqs;
+        std::vector<std::string> orderOnlyPrereqs;
+        std::vector<std::string> recipes;
+        std::vector<size_t> recipeLinenos;
+        std::optional<std::string> stem;
+        /* The targets of its `&:` group in order, or only itself. */
+        std::vector<std::string> group;
+        /* The variables its recipes are expanded with. */
+        const Variables* scope;
+        bool phony = false;
+        bool restat = false;
+        bool changedDependent = false;
+    };
+
+    /* Every target of the snapshot, sorted by name. */
+    std::vector<Entry> entries;
+
+    /* The parser, kept alive for its variables and file statuses. */
+    std::shared_ptr<const MakefileParser> owner;
+
+    std::string makefilePath;
+    std::string directory;
+
+    /* True if the changed files are known, see
+     * `MakefileParser::setChangedFiles`. */
+    bool changedFilesKnown;
+
+    /* The parser's file statuses and restat log. */
+    FileStatus* fileStatus;
+    RestatLog* restatLog;
+
+    const Entry* find(const std::string& target) const;
+    bool outdatedFile(const std::string& target) const;
+};
+
+#endif  // MAKEFILE_SNAPSHOT_H
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef REMOTE_PROTOCOL_H
+#define REMOTE_PROTOCOL_H
+
+#include <string>
+
+/**
+ * @brief The protocol spoken between MiniMake and `minimake-worker` processes.
+ * Both sides exchange frames of a one-byte type, a four-byte big-endian length
+ * and that many bytes of payload. On connecting, MiniMake sends a `Directory`
+ * frame with its absolute working directory, which the worker runs recipes in.
+ * MiniMake then sends a `Recipe` frame, and the worker answers with any number
+ * of `Stdout` and `Stderr` frames carrying the recipe's output as it is
+ * written, then an `Exit` frame with its exit status in decimal. A connection
+ * can run any number of recipes one after another.
+ *
+ * Addresses are either `unix:PATH` for a Unix socket or `HOST:PORT` for TCP.
+ *
+ */
+namespace RemoteProtocol {
+enum class Frame : char {
+    Directory = 'D',
+    Recipe = 'R',
+    Stdout = 'O',
+    Stderr = 'E',
+    Exit = 'X',
+};
+
+bool sendFrame(int fd, Frame type, const std::string& payload);
+bool receiveFrame(int fd, Frame& type, std::string& payload);
+int connectTo(const std::string& address);
+int listenOn(const std::string& address);
+}  // namespace RemoteProtocol
+
+#endif  // REMOTE_PROTOCOL_H
\ No newline at end of file
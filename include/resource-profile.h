@@ -0,0 +1,35 @@
+#ifndef RESOURCE_PROFILE_H
+#define RESOURCE_PROFILE_H
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "executor.h"
+
+/**
+ * @brief Adds up what the recipes of each target took, and reports the
+ * targets that took the longest or the most memory, e.g. to find out which
+ * targets to split or to give more memory. Recipes may finish on any thread.
+ *
+ */
+class ResourceProfile {
+   public:
+    void add(const std::string& target, const ResourceUsage& usage);
+    std::map<std::string, ResourceUsage> getUsages();
+    void writeTop(std::ostream& out, size_t count);
+    void writeCsv(std::ostream& out);
+    void writeJson(std::ostream& out);
+    bool writeFile(const std::string& path);
+
+    PRIVATE
+    /* The times and context switches of all recipes of each target, and
+     * the peak memory of its hungriest recipe. */
+    std::map<std::string, ResourceUsage> usages;
+
+    /* Guards `usages`. */
+    std::mutex mutex;
+};
+
+#endif  // RESOURCE_PROFILE_H
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef RESTAT_LOG_H
+#define RESTAT_LOG_H
+
+#include <time.h>
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Remembers, across builds, the targets whose recipes last ran without
+ * modifying them. Each is recorded with the last-modified time of its newest
+ * prerequisite at that run, so it counts as built as of then even though its
+ * file is older. Safe to use from many threads at once.
+ *
+ */
+class RestatLog {
+   public:
+    RestatLog(){};
+    void load(const std::string& path);
+    void save(const std::string& path);
+    std::optional<timespec> builtAsOf(const std::string& target);
+    void record(const std::string& target, timespec time);
+    void erase(const std::string& target);
+
+    PRIVATE
+    /* The time each recorded target counts as built as of. */
+    std::unordered_map<std::string, timespec> times;
+
+    /* True if `times` changed since it was loaded or saved. */
+    bool changed = false;
+
+    /* Guards `times` and `changed`. */
+    std::mutex mutex;
+};
+
+#endif  // RESTAT_LOG_H
\ No newline at end of file
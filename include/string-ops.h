@@ -9,4 +9,7 @@
 namespace StringOps {
 std::string trim(const std::string& str);
 std::vector<std::string> split(const std::string& str, char delimiter);
+std::string join(const std::vector<std::string>& strs, char delimiter);
+std::string jsonString(const std::string& str);
+std::string csvField(const std::string& str);
 }  // namespace StringOps
\ No newline at end of file
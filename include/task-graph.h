@@ -1,4 +1,8 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
 #include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -12,7 +16,42 @@ struct Task {
     std::string task{};                     /* Name of this task. */
     std::vector<std::string> parentTasks{}; /* Tasks that this depends on. */
     std::function<bool(std::string)> runTask{}; /* False if failed. */
+    std::string pool{}; /* Pool that limits this task. Empty if none. */
+
+    /* Used instead of `runTask` if set. Starts the task without waiting for
+     * it, and calls the given function from any thread once the task
+     * finishes, with false if it failed. */
+    std::function<void(std::string, std::function<void(bool)>)> startTask{};
+};
+
+/**
+ * @brief What a simulated run of tasks took on a virtual clock, in the units
+ * of the simulated task durations.
+ *
+ */
+struct Simulation {
+    size_t numTasks = 0; /* Tasks that ran. */
+    bool complete = false; /* True if every task ran. */
+
+    /* Time from the first task starting to the last one finishing. */
+    double makespan = 0;
+
+    /* Time the tasks ran for, summed over all tasks. */
+    double busyTime = 0;
+
+    /* Time the slots were free, summed over all slots. */
+    double idleTime = 0;
+
+    /* The fraction of the slots' time that tasks ran in. */
+    double utilization = 0;
 };
 
-bool run(const std::vector<Task>& tasks, int maxThreads);
-}  // namespace TaskGraph
\ No newline at end of file
+bool run(const std::vector<Task>& tasks, int maxThreads,
+         const std::map<std::string, size_t>& poolDepths = {},
+         std::map<std::string, double>* waits = nullptr);
+Simulation simulate(const std::vector<Task>& tasks, int maxThreads,
+                    const std::function<double(const std::string&)>& duration,
+                    const std::map<std::string, size_t>& poolDepths = {});
+}  // namespace TaskGraph
+
+#endif  // TASK_GRAPH_H
\ No newline at end of file
@@ -2,21 +2,43 @@
 #define VARIABLES_H
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "exception.h"
 
 /**
- * @brief Stores all variables so it can expand variable references.
+ * @brief Stores all variables so it can expand variable references. Variables
+ * form a chain of scopes, e.g. a target's own variables in front of the
+ * makefile's. A scope holds only the variables defined in it, and a reference
+ * is looked up in each scope of the chain in turn, innermost first.
  *
  */
 class Variables {
    public:
-    Variables(){};
+    /* How a variable's value is expanded when the variable is referenced. */
+    enum class Flavor {
+        Recursive, /* Expanded again on every reference. */
+        Simple,    /* Expanded once when defined, then used as is. */
+    };
+
+    Variables(const Variables* parent = nullptr)
+        : parent(parent),
+          functionCache(parent ? nullptr : std::make_shared<FunctionCache>()){};
     void addVariable(const std::string& name, const std::string& value,
-                     size_t lineno);
-    std::string expandVariables(const std::string& input, size_t lineno);
+                     size_t lineno, Flavor flavor = Flavor::Recursive);
+    void appendVariable(const std::string& name, const std::string& value,
+                        size_t lineno);
+    bool defined(const std::string& name) const;
+    void setDirectory(const std::string& directory);
+    void clearFunctionCache();
+    std::string expandVariables(
+        const std::string& input, size_t lineno,
+        const std::map<std::string, std::string>& automaticVariables = {})
+        const;
 
     class VariablesException : public PrintfException {
        public:
@@ -28,15 +50,68 @@ class Variables {
     };
 
     PRIVATE
-    /* The value for each variable name added. */
+    /* The enclosing scope, or nullptr for the outermost one. Must outlive
+     * this scope. */
+    const Variables* parent;
+
+    /* The directory relative paths of the file function are in. Empty for
+     * the working directory. Only used in the outermost scope. */
+    std::string directory;
+
+    /* The value for each variable name added to this scope. */
     std::map<std::string, std::string> variables;
 
     /* The lineno where each added variable name was defined. */
     std::map<std::string, size_t> variableLinenos;
 
-    /* Variables currently in process of being expanded in an `expandVariables`
-     * call.*/
-    std::set<std::string> expandingVariables;
+    /* The flavor of each added variable name. */
+    std::map<std::string, Flavor> variableFlavors;
+
+    /* What the file system and shell functions found, so that calling them
+     * again with the same arguments in this run costs no syscalls. */
+    struct FunctionCache {
+        /* The names in each directory scanned by the wildcard function, by
+         * its path as given to the file system, sorted. Empty if it is no
+         * directory. */
+        std::map<std::string, std::vector<std::string>> directories;
+
+        /* The expansion of each command run by the shell function. */
+        std::map<std::string, std::string> commands;
+
+        /* Guards the caches, since expanding is done from many threads. */
+        std::mutex mutex;
+    };
+
+    /* Only set in the outermost scope, and shared by all scopes in it. */
+    std::shared_ptr<FunctionCache> functionCache;
+
+    /* The state of one `expandVariables` call. Kept out of the variables, so
+     * that expanding does not modify them and is safe from many threads. */
+    struct Expansion {
+        /* Values that take precedence over the variables and are used as
+         * is, like those of the automatic variables of a recipe. */
+        const std::map<std::string, std::string>& automaticVariables;
+
+        /* Variables currently in process of being expanded. */
+        std::set<std::string> expandingVariables;
+    };
+
+    const Variables* scopeOf(const std::string& name) const;
+    std::string expand(const std::string& input, size_t lineno,
+                       Expansion& expansion) const;
+    static size_t findClosingParen(const std::string& input, size_t openPos);
+    static std::vector<std::string> splitArguments(const std::string& arguments,
+                                                   size_t maxArguments);
+    const Variables& outermost() const;
+    std::string callFunction(const std::string& function,
+                             const std::string& arguments, size_t lineno,
+                             Expansion& expansion) const;
+    std::string fileFunction(const std::string& arguments, size_t lineno,
+                             Expansion& expansion) const;
+    std::string wildcardFunction(const std::string& patterns) const;
+    const std::vector<std::string>& scanDirectory(const std::string& path)
+        const;
+    std::string shellFunction(const std::string& command, size_t lineno) const;
 };
 
 #endif  // VARIABLES_H
\ No newline at end of file
@@ -0,0 +1,241 @@
+#include "action-cache.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <openssl/evp.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <tuple>
+
+namespace {
+
+/**
+ * @brief Hashes data that is given in pieces with SHA-256.
+ *
+ */
+class Sha256 {
+   public:
+    Sha256() : context(EVP_MD_CTX_new(), EVP_MD_CTX_free) {
+        EVP_DigestInit_ex(context.get(), EVP_sha256(), NULL);
+    }
+
+    void update(const char* data, size_t size) {
+        EVP_DigestUpdate(context.get(), data, size);
+    }
+
+    /* Includes the terminating null, so consecutive strings cannot run into
+     * each other. */
+    void update(const std::string& data) {
+        update(data.c_str(), data.size() + 1);
+    }
+
+    std::string hexDigest() {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+        EVP_DigestFinal_ex(context.get(), digest, &size);
+
+        std::string hex;
+        for (unsigned int i = 0; i < size; i++) {
+            hex += "0123456789abcdef"[digest[i] >> 4];
+            hex += "0123456789abcdef"[digest[i] & 0xf];
+        }
+        return hex;
+    }
+
+   private:
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context;
+};
+
+/**
+ * @brief Copies the file at `from` to `to`, sharing the data on disk when the
+ * file system supports reflinks. The copy is written under a temporary name and
+ * then renamed, so `to` is never seen half written. Returns false if copying
+ * fails.
+ *
+ */
+bool cloneFile(const std::string& from, const std::string& to) {
+    size_t threadId = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    std::string tempPath = to + ".tmp" + std::to_string(getpid()) + "-" +
+                           std::to_string(threadId);
+
+    int fromFd = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fromFd == -1) {
+        return false;
+    }
+    struct stat fromStat;
+    int toFd = -1;
+    if (fstat(fromFd, &fromStat) == 0) {
+        toFd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    fromStat.st_mode & 07777);
+    }
+    bool copied = toFd != -1 && ioctl(toFd, FICLONE, fromFd) == 0;
+    close(fromFd);
+    if (toFd != -1) {
+        close(toFd);
+    }
+    if (toFd == -1) {
+        return false;
+    }
+
+    /* Reflinks are not supported here, so copy the data. */
+    if (!copied) {
+        std::error_code error;
+        copied = std::filesystem::copy_file(
+            from, tempPath, std::filesystem::copy_options::overwrite_existing,
+            error);
+    }
+
+    if (!copied || rename(tempPath.c_str(), to.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+/**
+ * @brief Uses the directory for cache entries, creating it if needed. Once
+ * entries take up more than `maxSize` bytes, `evict` removes the least recently
+ * used ones. A `maxSize` of 0 means no limit.
+ *
+ */
+ActionCache::ActionCache(const std::string& directory, uintmax_t maxSize)
+    : directory(directory), maxSize(maxSize) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+}
+
+/**
+ * @brief Returns the key of the entry for a target built by the given expanded
+ * recipes from the given prerequisites. The key hashes the target, the recipes,
+ * and the name and contents of each prerequisite.
+ *
+ */
+std::string ActionCache::key(const std::string& target,
+                             const std::vector<std::string>& recipes,
+                             const std::vector<std::string>& prereqs) {
+    Sha256 hash;
+    hash.update(target);
+    hash.update(std::to_string(recipes.size()));
+    for (const std::string& recipe : recipes) {
+        hash.update(recipe);
+    }
+    hash.update(std::to_string(prereqs.size()));
+    for (const std::string& prereq : prereqs) {
+        hash.update(prereq);
+        hash.update(contentHash(prereq));
+    }
+    return hash.hexDigest();
+}
+
+/**
+ * @brief Replaces the target with a copy of the entry for the key and marks the
+ * entry as recently used. Returns false if there is no such entry or it cannot
+ * be copied.
+ *
+ */
+bool ActionCache::restore(const std::string& key, const std::string& target) {
+    std::string entry = directory + "/" + key;
+    if (access(entry.c_str(), R_OK) != 0 || !cloneFile(entry, target)) {
+        return false;
+    }
+    utimensat(AT_FDCWD, entry.c_str(), NULL, 0);
+    return true;
+}
+
+/**
+ * @brief Stores a copy of the target as the entry for the key. Targets that are
+ * not regular files, e.g. because the recipes did not create them, are not
+ * stored.
+ *
+ */
+void ActionCache::store(const std::string& key, const std::string& target) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(target, error)) {
+        return;
+    }
+    cloneFile(target, directory + "/" + key);
+}
+
+/**
+ * @brief Removes the least recently used entries until the entries fit in the
+ * maximum size.
+ *
+ */
+void ActionCache::evict() {
+    if (maxSize == 0) {
+        return;
+    }
+
+    /* The last-used time, size and path of each entry. */
+    std::vector<std::tuple<std::filesystem::file_time_type, uintmax_t,
+                           std::filesystem::path>>
+        entries;
+    uintmax_t totalSize = 0;
+    std::error_code error;
+    for (const auto& file :
+         std::filesystem::directory_iterator(directory, error)) {
+        if (!file.is_regular_file(error)) {
+            continue;
+        }
+        uintmax_t size = file.file_size(error);
+        entries.emplace_back(file.last_write_time(error), size, file.path());
+        totalSize += size;
+    }
+
+    std::sort(entries.begin(), entries.end());
+    for (const auto& [lastUsed, size, path] : entries) {
+        if (totalSize <= maxSize) {
+            break;
+        }
+        if (std::filesystem::remove(path, error)) {
+            totalSize -= size;
+        }
+    }
+}
+
+/**
+ * @brief Returns a hash of the contents of the file at the path. A missing file
+ * or a directory gets a fixed hash, since only its existence matters.
+ *
+ */
+std::string ActionCache::contentHash(const std::string& path) {
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0) {
+        return "missing";
+    }
+    if (!S_ISREG(fileStat.st_mode)) {
+        return "not a file";
+    }
+
+    std::string version = path + '\0' + std::to_string(fileStat.st_size) +
+                          '\0' + std::to_string(fileStat.st_mtim.tv_sec) +
+                          '.' + std::to_string(fileStat.st_mtim.tv_nsec);
+    {
+        std::lock_guard lock(contentHashesMutex);
+        auto found = contentHashes.find(version);
+        if (found != contentHashes.end()) {
+            return found->second;
+        }
+    }
+
+    Sha256 hash;
+    std::ifstream file(path, std::ios::binary);
+    char buffer[1 << 16];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        hash.update(buffer, file.gcount());
+    }
+    std::string result = hash.hexDigest();
+
+    std::lock_guard lock(contentHashesMutex);
+    contentHashes[version] = result;
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "cpu-quota.h"
+
+#include <sched.h>
+
+#include <cerrno>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace CpuQuota {
+
+namespace {
+
+/* Most CPUs that an affinity mask is looked up for. */
+constexpr int MAX_CPUS = 1 << 16;
+
+/**
+ * @brief Calls `visit` with this process's affinity mask and its size. The
+ * mask is allocated to fit as many CPUs as the kernel has, since a fixed
+ * `cpu_set_t` only fits 1024. Returns false if it could not be read.
+ *
+ */
+bool withAffinity(
+    const std::function<void(const cpu_set_t*, size_t)>& visit) {
+    for (int numCpus = CPU_SETSIZE; numCpus <= MAX_CPUS; numCpus *= 2) {
+        cpu_set_t* set = CPU_ALLOC(numCpus);
+        if (!set) {
+            return false;
+        }
+        size_t size = CPU_ALLOC_SIZE(numCpus);
+        bool read = sched_getaffinity(0, size, set) == 0;
+        if (read) {
+            visit(set, size);
+        }
+        CPU_FREE(set);
+        if (read || errno != EINVAL) {
+            return read;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Returns the cgroup v2 path of this process, relative to the cgroup
+ * root, or nothing if it is not in a cgroup v2 hierarchy.
+ *
+ */
+std::optional<std::string> ownCgroup() {
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.starts_with("0::")) {
+            return line.substr(3);
+        }
+    }
+    return std::nullopt;
+}
+
+}  // namespace
+
+/**
+ * @brief Returns the number of CPUs this process may be scheduled on, which
+ * is at least 1.
+ *
+ */
+size_t affinityCpus() {
+    int count = 1;
+    withAffinity([&](const cpu_set_t* set, size_t size) {
+        count = std::max(CPU_COUNT_S(size, set), 1);
+    });
+    return count;
+}
+
+/**
+ * @brief Returns the CPUs this process may be scheduled on, in ascending
+ * order.
+ *
+ */
+std::vector<int> affinityCpuList() {
+    std::vector<int> cpus;
+    withAffinity([&](const cpu_set_t* set, size_t size) {
+        for (size_t cpu = 0; cpu < size * 8; cpu++) {
+            if (CPU_ISSET_S(cpu, size, set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    });
+    return cpus;
+}
+
+/**
+ * @brief Parses a list of CPUs in the kernel's format, e.g. `0-3,8,10-11`.
+ * Malformed parts are skipped.
+ *
+ */
+std::vector<int> parseCpuList(const std::string& cpuList) {
+    std::vector<int> cpus;
+    std::istringstream parts(cpuList);
+    std::string part;
+    while (std::getline(parts, part, ',')) {
+        try {
+            size_t dash = part.find('-');
+            int first = std::stoi(part.substr(0, dash));
+            int last = dash == std::string::npos
+                           ? first
+                           : std::stoi(part.substr(dash + 1));
+            for (int cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::logic_error&) {
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief Returns the CPUs of each NUMA node that this process may be
+ * scheduled on, by node number. Nodes without any such CPU are left out.
+ * Without NUMA information, all CPUs are taken to be on one node.
+ *
+ */
+std::vector<std::vector<int>> numaNodes(const std::string& root) {
+    std::vector<int> allowed = affinityCpuList();
+    std::set<int> allowedSet(allowed.begin(), allowed.end());
+
+    /* Node directories are named `node` followed by the node number. */
+    std::map<int, std::vector<int>> nodes;
+    std::error_code error;
+    for (const auto& entry :
+         std::filesystem::directory_iterator(root, error)) {
+        std::string name = entry.path().filename().string();
+        if (!name.starts_with("node") || name.size() == 4 ||
+            name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        std::ifstream file(entry.path() / "cpulist");
+        std::string cpuList;
+        std::getline(file, cpuList);
+        std::vector<int>& cpus = nodes[std::stoi(name.substr(4))];
+        for (int cpu : parseCpuList(cpuList)) {
+            if (allowedSet.contains(cpu)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    std::vector<std::vector<int>> result;
+    for (auto& [node, cpus] : nodes) {
+        if (!cpus.empty()) {
+            result.push_back(std::move(cpus));
+        }
+    }
+    if (result.empty() && !allowed.empty()) {
+        result.push_back(allowed);
+    }
+    return result;
+}
+
+/**
+ * @brief Returns the number of CPUs the cgroup v2 `cpu.max` quotas of the
+ * given cgroup and its ancestors allow, rounded up, or nothing if none sets a
+ * quota. The cgroup is a path below the root, this process's own by default.
+ *
+ */
+std::optional<size_t> cgroupCpus(const std::string& root,
+                                 const std::string& cgroup) {
+    std::optional<std::string> path = cgroup;
+    if (cgroup.empty()) {
+        path = ownCgroup();
+        if (!path) {
+            return std::nullopt;
+        }
+    }
+
+    /* The tightest quota on the way down from the root applies. */
+    std::vector<std::filesystem::path> directories = {root};
+    for (const std::filesystem::path& part :
+         std::filesystem::path(*path).relative_path()) {
+        if (!part.empty()) {
+            directories.push_back(directories.back() / part);
+        }
+    }
+
+    std::optional<size_t> cpus;
+    for (const std::filesystem::path& directory : directories) {
+        std::ifstream file(directory / "cpu.max");
+        std::string quota;
+        unsigned long long period;
+        if (!(file >> quota >> period) || quota == "max" || period == 0) {
+            continue;
+        }
+        try {
+            /* A quota below one CPU still needs one job. */
+            size_t allowed =
+                std::max((std::stoull(quota) + period - 1) / period, 1ULL);
+            cpus = std::min(cpus.value_or(allowed), allowed);
+        } catch (const std::logic_error&) {
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @brief Returns the number of CPUs this process can keep busy: those it may
+ * be scheduled on, capped by its cgroup's quota. Cheap enough to call again
+ * while building, to follow a container being resized.
+ *
+ */
+size_t availableCpus() {
+    size_t cpus = affinityCpus();
+    std::optional<size_t> quota = cgroupCpus();
+    return quota ? std::min(cpus, *quota) : cpus;
+}
+
+}  // namespace CpuQuota
\ No newline at end of file
@@ -0,0 +1,493 @@
+#include "dag-analysis.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <queue>
+#include <set>
+#include <sstream>
+
+#include "string-ops.h"
+
+namespace DagAnalysis {
+
+namespace {
+
+/* How much heavier than its share a subtree may be before it is split once
+ * there are enough subtrees to go round the shards. */
+constexpr double MAX_SHARD_IMBALANCE = 0.25;
+
+/**
+ * @brief Returns the task and every task it transitively depends on, by index.
+ * Tasks found are marked in `foundFrom` with the index of the task, so it is
+ * not cleared between calls for different tasks.
+ *
+ */
+std::vector<size_t> closure(size_t task,
+                            const std::vector<std::vector<size_t>>& parents,
+                            std::vector<size_t>& foundFrom) {
+    std::vector<size_t> result = {task};
+    foundFrom[task] = task;
+    for (size_t i = 0; i < result.size(); i++) {
+        for (size_t parent : parents[result[i]]) {
+            if (foundFrom[parent] != task) {
+                foundFrom[parent] = task;
+                result.push_back(parent);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Returns the string as a DOT identifier.
+ *
+ */
+std::string dotString(const std::string& str) {
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result + '"';
+}
+
+}  // namespace
+
+/**
+ * @brief Analyzes the DAG of the given tasks in time linear in its size. Like
+ * `TaskGraph::run`, ignores parents that are not tasks and tasks defined a
+ * second time. Tasks without a recorded duration weigh 0 if any durations are
+ * given, e.g. source files that no recipe builds. The tasks must not form a
+ * cycle, and any task in one is left out.
+ *
+ */
+Report analyze(const std::vector<TaskGraph::Task>& tasks,
+               const std::map<std::string, double>& durations) {
+    Report report;
+
+    /* For each task, its parents and the tasks it is a parent for. */
+    std::map<std::string, std::vector<std::string>> parents;
+    std::map<std::string, std::vector<std::string>> children;
+    for (const TaskGraph::Task& task : tasks) {
+        if (parents.contains(task.task)) {
+            continue;
+        }
+        parents[task.task];
+        report.numNodes++;
+        auto duration = durations.find(task.task);
+        report.weights[task.task] =
+            duration != durations.end() ? duration->second
+            : durations.empty()         ? 1
+                                        : 0;
+        report.totalWeight += report.weights[task.task];
+    }
+    std::set<std::string> defined;
+    for (const TaskGraph::Task& task : tasks) {
+        if (!defined.insert(task.task).second) {
+            continue;
+        }
+        std::vector<std::string>& taskParents = parents[task.task];
+        std::set<std::string> seen;
+        for (const std::string& parent : task.parentTasks) {
+            if (parents.contains(parent) && seen.insert(parent).second) {
+                taskParents.push_back(parent);
+                children[parent].push_back(task.task);
+                report.numEdges++;
+            }
+        }
+    }
+
+    /* Visit tasks in dependency order, tracking the level of each and the
+     * heaviest chain ending in each. */
+    std::map<std::string, size_t> numWaiting;
+    std::deque<std::string> ready;
+    for (const auto& [task, taskParents] : parents) {
+        numWaiting[task] = taskParents.size();
+        if (taskParents.empty()) {
+            ready.push_back(task);
+        }
+    }
+    std::map<std::string, double> chainWeights;
+    std::map<std::string, std::string> heaviestParents;
+    std::string heaviestTask;
+    while (!ready.empty()) {
+        std::string task = ready.front();
+        ready.pop_front();
+
+        size_t level = 0;
+        double chainWeight = 0;
+        for (const std::string& parent : parents[task]) {
+            level = std::max(level, report.levels[parent] + 1);
+            if (chainWeights[parent] > chainWeight ||
+                !heaviestParents.contains(task)) {
+                chainWeight = chainWeights[parent];
+                heaviestParents[task] = parent;
+            }
+        }
+        report.levels[task] = level;
+        chainWeights[task] = chainWeight + report.weights[task];
+        if (report.levelWidths.size() <= level) {
+            report.levelWidths.resize(level + 1);
+        }
+        report.levelWidths[level]++;
+        /* On a tie, prefer the later task, so that the path runs on
+         * through tasks that weigh nothing. */
+        if (heaviestTask.empty() ||
+            chainWeights[task] >= chainWeights[heaviestTask]) {
+            heaviestTask = task;
+        }
+
+        for (const std::string& child : children[task]) {
+            if (--numWaiting[child] == 0) {
+                ready.push_back(child);
+            }
+        }
+    }
+
+    /* Walk the heaviest chain back from its last task. */
+    if (!heaviestTask.empty()) {
+        report.criticalPathWeight = chainWeights[heaviestTask];
+        for (std::string task = heaviestTask; !task.empty();) {
+            report.criticalPath.push_back(task);
+            auto parent = heaviestParents.find(task);
+            task = parent == heaviestParents.end() ? "" : parent->second;
+        }
+        std::reverse(report.criticalPath.begin(), report.criticalPath.end());
+    }
+    return report;
+}
+
+/**
+ * @brief Reads recorded durations from a CSV file of `target,seconds` records.
+ * Targets may be quoted, see `StringOps::csvField`. Records whose second field
+ * is not a number, like a header, are skipped, and so are any fields after it.
+ * Returns nothing if the file cannot be read.
+ *
+ */
+std::map<std::string, double> readDurations(const std::string& path) {
+    std::map<std::string, double> durations;
+    std::ifstream file(path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string data = buffer.str();
+
+    size_t pos = 0;
+    while (pos < data.size()) {
+        /* A quoted target may hold commas and line breaks, and doubles its
+         * quotes. */
+        std::string target;
+        if (data[pos] == '"') {
+            for (pos++; pos < data.size(); pos++) {
+                if (data[pos] == '"') {
+                    if (pos + 1 == data.size() || data[pos + 1] != '"') {
+                        pos++;
+                        break;
+                    }
+                    pos++;
+                }
+                target += data[pos];
+            }
+        } else {
+            size_t end = std::min(data.find_first_of(",\n", pos), data.size());
+            target = data.substr(pos, end - pos);
+            pos = end;
+        }
+
+        size_t lineEnd = std::min(data.find('\n', pos), data.size());
+        std::string rest = data.substr(pos, lineEnd - pos);
+        pos = lineEnd + 1;
+        if (!rest.starts_with(',')) {
+            continue;
+        }
+        try {
+            durations[target] = std::stod(rest.substr(1));
+        } catch (const std::logic_error&) {
+        }
+    }
+    return durations;
+}
+
+/**
+ * @brief Writes the report for people to read.
+ *
+ */
+void writeText(std::ostream& out, const Report& report) {
+    out << "nodes: " << report.numNodes << '\n';
+    out << "edges: " << report.numEdges << '\n';
+    out << "depth: " << report.levelWidths.size() << '\n';
+
+    out << "critical path (" << report.criticalPathWeight << "):";
+    for (const std::string& task : report.criticalPath) {
+        out << (&task == &report.criticalPath.front() ? " " : " -> ") << task;
+    }
+    out << '\n';
+
+    /* The total weight over the critical path's bounds the speedup that any
+     * number of jobs can give. */
+    out << "parallelism: "
+        << (report.criticalPathWeight > 0
+                ? report.totalWeight / report.criticalPathWeight
+                : 0)
+        << '\n';
+
+    out << "level widths:";
+    size_t maxWidth = 0;
+    for (size_t width : report.levelWidths) {
+        out << ' ' << width;
+        maxWidth = std::max(maxWidth, width);
+    }
+    out << '\n';
+    out << "max useful jobs: " << maxWidth << '\n';
+}
+
+/**
+ * @brief Writes the DAG in the DOT language of Graphviz, with edges from
+ * prerequisites to the targets that depend on them. Tasks are labeled with
+ * their weights, and the critical path is drawn in red.
+ *
+ */
+void writeDot(std::ostream& out, const std::vector<TaskGraph::Task>& tasks,
+              const Report& report) {
+    std::set<std::string> critical(report.criticalPath.begin(),
+                                   report.criticalPath.end());
+    std::set<std::pair<std::string, std::string>> criticalEdges;
+    for (size_t i = 1; i < report.criticalPath.size(); i++) {
+        criticalEdges.emplace(report.criticalPath[i - 1],
+                              report.criticalPath[i]);
+    }
+    out << "digraph make {\n";
+    for (const auto& [task, weight] : report.weights) {
+        std::ostringstream label;
+        label << task << "\\n" << weight;
+        out << "    " << dotString(task) << " [label=" << dotString(label.str())
+            << (critical.contains(task) ? ", color=red" : "") << "];\n";
+    }
+
+    std::set<std::pair<std::string, std::string>> edges;
+    for (const TaskGraph::Task& task : tasks) {
+        for (const std::string& parent : task.parentTasks) {
+            if (report.weights.contains(parent) &&
+                edges.emplace(parent, task.task).second) {
+                out << "    " << dotString(parent) << " -> "
+                    << dotString(task.task)
+                    << (criticalEdges.contains({parent, task.task})
+                            ? " [color=red]"
+                            : "")
+                    << ";\n";
+            }
+        }
+    }
+    out << "}\n";
+}
+
+/**
+ * @brief Writes the report and the DAG as a JSON object, for other tools.
+ *
+ */
+void writeJson(std::ostream& out, const std::vector<TaskGraph::Task>& tasks,
+               const Report& report) {
+    out << "{\"nodes\": " << report.numNodes
+        << ", \"edges\": " << report.numEdges
+        << ", \"depth\": " << report.levelWidths.size()
+        << ", \"criticalPathWeight\": " << report.criticalPathWeight
+        << ", \"totalWeight\": " << report.totalWeight << ",\n";
+
+    out << " \"criticalPath\": [";
+    for (const std::string& task : report.criticalPath) {
+        out << (&task == &report.criticalPath.front() ? "" : ", ")
+            << StringOps::jsonString(task);
+    }
+    out << "],\n \"levelWidths\": [";
+    for (size_t i = 0; i < report.levelWidths.size(); i++) {
+        out << (i == 0 ? "" : ", ") << report.levelWidths[i];
+    }
+    out << "],\n \"tasks\": [";
+
+    std::set<std::string> written;
+    for (const TaskGraph::Task& task : tasks) {
+        if (!report.levels.contains(task.task) ||
+            !written.insert(task.task).second) {
+            continue;
+        }
+        out << (written.size() == 1 ? "\n" : ",\n") << "  {\"name\": "
+            << StringOps::jsonString(task.task)
+            << ", \"level\": " << report.levels.at(task.task)
+            << ", \"weight\": " << report.weights.at(task.task)
+            << ", \"prerequisites\": [";
+        bool first = true;
+        for (const std::string& parent : task.parentTasks) {
+            if (report.weights.contains(parent)) {
+                out << (first ? "" : ", ") << StringOps::jsonString(parent);
+                first = false;
+            }
+        }
+        out << "]}";
+    }
+    out << "]}\n";
+}
+
+/**
+ * @brief Splits building the goals into balanced shards, e.g. for separate
+ * machines, and returns the targets that each shard builds. Building a target
+ * builds everything it depends on, so a shard's part is the targets and their
+ * prerequisites. The split is deterministic for the same tasks.
+ *
+ * The goals are split into the subtrees of their prerequisites, the heaviest
+ * first, until there are at least as many subtrees as shards and none is more
+ * than `MAX_SHARD_IMBALANCE` heavier than a shard's share. Each subtree, the
+ * heaviest first, then goes to the shard where it adds the least weight on
+ * top of the shard's weight so far, counting prerequisites already in that
+ * shard only once. So subtrees that share prerequisites tend to end up in the
+ * same shard. Tasks are weighed as by `analyze`. The goals and the targets that
+ * were split up are left for a final unsharded build of the goals, which then
+ * only has to run their own recipes.
+ *
+ * Each subtree's tasks and weight are found once, when it is split off. The
+ * heaviest subtree is taken from a heap, and placing a subtree takes a pass
+ * over its tasks and the shards that already cover them, plus one over the
+ * shards. So the cost is dominated by the subtrees' sizes, which overlap where
+ * they share prerequisites.
+ *
+ */
+std::vector<std::vector<std::string>> shard(
+    const std::vector<TaskGraph::Task>& tasks,
+    const std::vector<std::string>& goals, size_t numShards,
+    const std::map<std::string, double>& durations) {
+    std::vector<std::vector<std::string>> shards(numShards);
+    if (numShards == 0) {
+        return shards;
+    }
+    Report report = analyze(tasks, durations);
+
+    /* Number the tasks in order of their names, so that ties are broken by
+     * name, and find each one's parents that are tasks, as in `analyze`. */
+    std::vector<std::string> names;
+    std::vector<double> weights;
+    std::map<std::string, size_t> indexes;
+    for (const auto& [task, weight] : report.weights) {
+        indexes[task] = names.size();
+        names.push_back(task);
+        weights.push_back(weight);
+    }
+    std::vector<std::vector<size_t>> parents(names.size());
+    std::vector<bool> defined(names.size());
+    for (const TaskGraph::Task& task : tasks) {
+        size_t index = indexes.at(task.task);
+        if (defined[index]) {
+            continue;
+        }
+        defined[index] = true;
+        for (const std::string& parent : task.parentTasks) {
+            auto parentIndex = indexes.find(parent);
+            if (parentIndex != indexes.end() &&
+                std::find(parents[index].begin(), parents[index].end(),
+                          parentIndex->second) == parents[index].end()) {
+                parents[index].push_back(parentIndex->second);
+            }
+        }
+    }
+
+    /* Each subtree by the index of its task, with its weight, which is
+     * summed once when the subtree is found. */
+    struct Subtree {
+        std::vector<size_t> tasks;
+        double weight = 0;
+    };
+    std::map<size_t, Subtree> subtrees;
+
+    /* The subtrees that can be split, heaviest on top, and of those the one
+     * whose task comes first. */
+    auto lighter = [](const std::pair<double, size_t>& first,
+                      const std::pair<double, size_t>& second) {
+        return first.first < second.first ||
+               (first.first == second.first && first.second > second.second);
+    };
+    std::priority_queue<std::pair<double, size_t>,
+                        std::vector<std::pair<double, size_t>>,
+                        decltype(lighter)>
+        splittable(lighter);
+
+    std::vector<size_t> foundFrom(names.size(), names.size());
+    auto addSubtree = [&](size_t task) {
+        if (subtrees.contains(task)) {
+            return;
+        }
+        Subtree& subtree = subtrees[task];
+        subtree.tasks = closure(task, parents, foundFrom);
+        for (size_t index : subtree.tasks) {
+            subtree.weight += weights[index];
+        }
+        if (!parents[task].empty()) {
+            splittable.emplace(subtree.weight, task);
+        }
+    };
+    for (const std::string& goal : goals) {
+        auto index = indexes.find(goal);
+        if (index != indexes.end()) {
+            addSubtree(index->second);
+        }
+    }
+
+    /* Split the heaviest subtree while there are fewer subtrees than shards,
+     * or while it is too heavy for a shard. */
+    double maxWeight =
+        report.totalWeight / numShards * (1 + MAX_SHARD_IMBALANCE);
+    while (!splittable.empty() &&
+           (subtrees.size() < numShards ||
+            splittable.top().first > maxWeight)) {
+        size_t task = splittable.top().second;
+        splittable.pop();
+        subtrees.erase(task);
+        for (size_t parent : parents[task]) {
+            addSubtree(parent);
+        }
+    }
+
+    /* Place the heaviest subtrees first, each where it adds the least. The
+     * shards that already cover each task are kept per task, so the weight a
+     * subtree shares with each shard is found in one pass over its tasks. */
+    std::vector<std::pair<double, size_t>> order;
+    for (const auto& [task, subtree] : subtrees) {
+        order.emplace_back(-subtree.weight, task);
+    }
+    std::sort(order.begin(), order.end());
+    std::vector<std::vector<size_t>> owners(names.size());
+    std::vector<double> loads(numShards);
+    std::vector<double> shared(numShards);
+    for (const auto& [negativeWeight, task] : order) {
+        const Subtree& subtree = subtrees[task];
+        std::fill(shared.begin(), shared.end(), 0);
+        for (size_t index : subtree.tasks) {
+            for (size_t owner : owners[index]) {
+                shared[owner] += weights[index];
+            }
+        }
+        size_t best = 0;
+        double bestLoad = 0;
+        for (size_t i = 0; i < numShards; i++) {
+            double load = loads[i] + subtree.weight - shared[i];
+            if (i == 0 || load < bestLoad) {
+                best = i;
+                bestLoad = load;
+            }
+        }
+        shards[best].push_back(names[task]);
+        for (size_t index : subtree.tasks) {
+            if (std::find(owners[index].begin(), owners[index].end(), best) ==
+                owners[index].end()) {
+                owners[index].push_back(best);
+            }
+        }
+        loads[best] = bestLoad;
+    }
+
+    for (std::vector<std::string>& targets : shards) {
+        std::sort(targets.begin(), targets.end());
+    }
+    return shards;
+}
+
+}  // namespace DagAnalysis
\ No newline at end of file
@@ -0,0 +1,685 @@
+#include "executor.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+
+#include "cpu-quota.h"
+#include "remote-protocol.h"
+
+namespace {
+
+/* Number of exited children the reactor handles per wakeup. */
+constexpr int REACTOR_BATCH = 64;
+
+/* How often a pool that follows the CPU quota looks it up again. */
+constexpr std::chrono::seconds QUOTA_CHECK_INTERVAL(1);
+
+/* Longest recipe passed to bash as an argument. The kernel rejects a single
+ * argument longer than 32 pages, so longer recipes are passed as a script. */
+constexpr size_t MAX_INLINE_RECIPE = 64 << 10;
+
+/**
+ * @brief Starts `bash -c recipe` in a child process, or has bash read a long
+ * recipe from an in-memory script file instead. Its stdout and stderr go to
+ * the given file descriptors, or are inherited if these are -1. The child only
+ * runs on the given CPUs, if any. Returns the child's pid, or -1 after
+ * outputting an error message if forking failed.
+ *
+ */
+pid_t startBash(const std::string& recipe, int stdoutFd = -1,
+                int stderrFd = -1, const std::vector<int>& cpus = {}) {
+    /* The set is made before forking, so the child only makes a syscall. It
+     * is sized to fit the highest CPU, which may be past 1024. */
+    int maxCpu = cpus.empty() ? 0 : *std::max_element(cpus.begin(), cpus.end());
+    std::vector<cpu_set_t> cpuSet(maxCpu / CPU_SETSIZE + 1);
+    size_t cpuSetSize = cpuSet.size() * sizeof(cpu_set_t);
+    CPU_ZERO_S(cpuSetSize, cpuSet.data());
+    for (int cpu : cpus) {
+        CPU_SET_S(cpu, cpuSetSize, cpuSet.data());
+    }
+
+    int scriptFd = -1;
+    std::string scriptPath;
+    if (recipe.size() > MAX_INLINE_RECIPE) {
+        /* Close-on-exec, so that recipes forked meanwhile by other threads do
+         * not inherit it. Only this recipe's child clears the flag. */
+        scriptFd = memfd_create("recipe", MFD_CLOEXEC);
+        if (scriptFd == -1 ||
+            write(scriptFd, recipe.data(), recipe.size()) !=
+                static_cast<ssize_t>(recipe.size())) {
+            perror("memfd_create failed");
+            if (scriptFd != -1) {
+                close(scriptFd);
+            }
+            return -1;
+        }
+        scriptPath = "/dev/fd/" + std::to_string(scriptFd);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork failed");
+    } else if (pid == 0) {
+        if (!cpus.empty()) {
+            sched_setaffinity(0, cpuSetSize, cpuSet.data());
+        }
+        if (stdoutFd != -1) {
+            dup2(stdoutFd, STDOUT_FILENO);
+        }
+        if (stderrFd != -1) {
+            dup2(stderrFd, STDERR_FILENO);
+        }
+        if (scriptFd != -1) {
+            fcntl(scriptFd, F_SETFD, 0);
+        }
+        const char* argv[] = {"bash", "-c", recipe.c_str(), NULL};
+        if (scriptFd != -1) {
+            argv[1] = scriptPath.c_str();
+            argv[2] = NULL;
+        }
+        execvp(argv[0], const_cast<char* const*>(argv));
+
+        /* Execvp only returns if an error occurred. */
+        perror("execvp failed");
+        _exit(127);
+    }
+    if (scriptFd != -1) {
+        close(scriptFd);
+    }
+    return pid;
+}
+
+/**
+ * @brief Returns the string quoted for bash, as one word.
+ *
+ */
+std::string shellQuote(const std::string& str) {
+    std::string result = "'";
+    for (char c : str) {
+        if (c == '\'') {
+            result += "'\\''";
+        } else {
+            result += c;
+        }
+    }
+    return result + "'";
+}
+
+/**
+ * @brief Returns the number of threads to run work for the given number of
+ * jobs on: one per job, but no more than there are hardware threads.
+ *
+ */
+size_t numWorkThreads(size_t numJobs) {
+    size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    return std::clamp<size_t>(numJobs, 1, hardwareThreads);
+}
+
+/**
+ * @brief Returns the seconds since the given time.
+ *
+ */
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+/**
+ * @brief Waits for the child process to end and returns its exit status. A
+ * child killed by a signal gets 128 plus the signal number, as in bash. Returns
+ * -1 after outputting an error message if waiting failed. Stores what the
+ * child used in `usage`, if given, except for its wall time.
+ *
+ */
+int waitForExit(pid_t pid, ResourceUsage* usage = nullptr) {
+    int status;
+    rusage childUsage;
+    while (wait4(pid, &status, 0, &childUsage) == -1) {
+        if (errno != EINTR) {
+            perror("wait4 failed");
+            return -1;
+        }
+    }
+    if (usage) {
+        usage->userSeconds =
+            childUsage.ru_utime.tv_sec + childUsage.ru_utime.tv_usec / 1e6;
+        usage->systemSeconds =
+            childUsage.ru_stime.tv_sec + childUsage.ru_stime.tv_usec / 1e6;
+        usage->maxRssKilobytes = childUsage.ru_maxrss;
+        usage->voluntarySwitches = childUsage.ru_nvcsw;
+        usage->involuntarySwitches = childUsage.ru_nivcsw;
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+}  // namespace
+
+WorkQueue::WorkQueue(size_t numThreads) {
+    for (size_t i = 0; i < numThreads; i++) {
+        threads.emplace_back(&WorkQueue::loop, this);
+    }
+}
+
+WorkQueue::~WorkQueue() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    posted.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Runs the work on one of the queue's threads once one is free.
+ *
+ */
+void WorkQueue::post(std::function<void()> work) {
+    {
+        std::lock_guard lock(mutex);
+        queue.push_back(std::move(work));
+    }
+    posted.notify_one();
+}
+
+/**
+ * @brief Runs posted work until the queue is destroyed and no work is left.
+ *
+ */
+void WorkQueue::loop() {
+    while (true) {
+        std::function<void()> work;
+        {
+            std::unique_lock lock(mutex);
+            posted.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            work = std::move(queue.front());
+            queue.pop_front();
+        }
+        work();
+    }
+}
+
+ProcessReactor::ProcessReactor(size_t numHandlers)
+    : epollFd(epoll_create1(EPOLL_CLOEXEC)),
+      wakeFd(eventfd(0, EFD_CLOEXEC)),
+      handlers(numHandlers) {
+    epoll_event event{.events = EPOLLIN, .data = {.fd = wakeFd}};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    thread = std::thread(&ProcessReactor::loop, this);
+}
+
+ProcessReactor::~ProcessReactor() {
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) != sizeof(one)) {
+        perror("write failed");
+    }
+    thread.join();
+    close(wakeFd);
+    close(epollFd);
+}
+
+/**
+ * @brief Calls `onExit` with the exit status of the child process once it
+ * exits, from one of the handler threads. If the kernel does not support
+ * pidfds, a thread is spent waiting on the child and calling `onExit`
+ * instead.
+ *
+ */
+void ProcessReactor::watch(pid_t pid, std::function<void(int)> onExit,
+                           ResourceUsage* usage) {
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd == -1) {
+        std::thread([pid, onExit, usage] {
+            onExit(waitForExit(pid, usage));
+        }).detach();
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        watched[pidfd] = {pid, onExit, usage};
+    }
+    epoll_event event{.events = EPOLLIN, .data = {.fd = pidfd}};
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, pidfd, &event);
+}
+
+/**
+ * @brief Waits until some watched children exit, reaps them and posts their
+ * exit handlers to the handler threads, until the reactor is destroyed.
+ *
+ */
+void ProcessReactor::loop() {
+    epoll_event events[REACTOR_BATCH];
+    while (true) {
+        int numEvents = epoll_wait(epollFd, events, REACTOR_BATCH, -1);
+        if (numEvents == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            return;
+        }
+
+        for (int i = 0; i < numEvents; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd) {
+                return;
+            }
+
+            /* A readable pidfd means the child exited, so reaping it does not
+             * block. */
+            Child child;
+            {
+                std::lock_guard lock(mutex);
+                child = std::move(watched[fd]);
+                watched.erase(fd);
+            }
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+            close(fd);
+            int status = waitForExit(child.pid, child.usage);
+            handlers.post([onExit = std::move(child.onExit), status] {
+                onExit(status);
+            });
+        }
+    }
+}
+
+/**
+ * @brief Runs the recipe on a thread of its own. Executors that can wait for
+ * recipes without blocking a thread override this.
+ *
+ */
+void Executor::start(const std::string& recipe,
+                     std::function<void(int)> onExit, ResourceUsage* usage) {
+    std::thread([this, recipe, onExit, usage] {
+        onExit(run(recipe, usage));
+    }).detach();
+}
+
+int LocalExecutor::run(const std::string& recipe, ResourceUsage* usage) {
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = startBash(recipe, -1, -1, cpus);
+    int status = pid == -1 ? -1 : waitForExit(pid, usage);
+    if (usage) {
+        usage->wallSeconds = secondsSince(started);
+    }
+    return status;
+}
+
+void LocalExecutor::start(const std::string& recipe,
+                          std::function<void(int)> onExit,
+                          ResourceUsage* usage) {
+    if (!reactor) {
+        Executor::start(recipe, onExit, usage);
+        return;
+    }
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid = startBash(recipe, -1, -1, cpus);
+    if (pid == -1) {
+        onExit(-1);
+        return;
+    }
+    reactor->watch(
+        pid,
+        [onExit, usage, started](int status) {
+            if (usage) {
+                usage->wallSeconds = secondsSince(started);
+            }
+            onExit(status);
+        },
+        usage);
+}
+
+RemoteExecutor::~RemoteExecutor() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+/**
+ * @brief Sends the recipe to the worker and passes on its output until it
+ * exits. Connects to the worker first if not connected yet.
+ *
+ */
+int RemoteExecutor::run(const std::string& recipe, ResourceUsage* usage) {
+    using RemoteProtocol::Frame;
+
+    /* Only the wall time is known of a recipe run by a worker. */
+    auto started = std::chrono::steady_clock::now();
+    if (usage) {
+        *usage = {};
+    }
+
+    bool sent = true;
+    if (fd == -1) {
+        fd = RemoteProtocol::connectTo(address);
+        if (fd == -1) {
+            perror(("connect failed for " + address).c_str());
+            return -1;
+        }
+
+        /* Recipes run in this process's working directory on the worker
+         * too, e.g. after `-C`, not in the worker's own. */
+        std::error_code error;
+        sent = RemoteProtocol::sendFrame(
+            fd, Frame::Directory,
+            std::filesystem::current_path(error).string());
+    }
+
+    Frame type;
+    std::string payload;
+    if (sent && RemoteProtocol::sendFrame(fd, Frame::Recipe, recipe)) {
+        while (RemoteProtocol::receiveFrame(fd, type, payload)) {
+            if (type == Frame::Stdout) {
+                std::cout.write(payload.data(), payload.size()).flush();
+            } else if (type == Frame::Stderr) {
+                std::cerr.write(payload.data(), payload.size()).flush();
+            } else if (type == Frame::Exit) {
+                /* A malformed status is as good as a broken connection. */
+                int status;
+                auto [end, error] = std::from_chars(
+                    payload.data(), payload.data() + payload.size(), status);
+                if (error != std::errc() ||
+                    end != payload.data() + payload.size()) {
+                    break;
+                }
+                if (status == -1) {
+                    std::cerr << "make: *** Worker " << address
+                              << " could not run the recipe\n";
+                }
+                if (usage) {
+                    usage->wallSeconds = secondsSince(started);
+                }
+                return status;
+            }
+        }
+    }
+
+    /* Reconnect for the next recipe. */
+    close(fd);
+    fd = -1;
+    std::cerr << "make: *** Lost connection to worker " << address << '\n';
+    return -1;
+}
+
+ExecutorPool::ExecutorPool(size_t numJobs,
+                           const std::vector<std::string>& addresses,
+                           bool followCpuQuota, Placement placement)
+    : numRemote(addresses.size()),
+      followCpuQuota(followCpuQuota),
+      workQueue(numWorkThreads(numJobs + addresses.size())) {
+    for (const std::string& address : addresses) {
+        executors.push_back(std::make_unique<RemoteExecutor>(address));
+    }
+    /* There must be somewhere to run recipes. */
+    if (numJobs == 0 && addresses.empty()) {
+        numJobs = 1;
+    }
+    localLimit = numJobs;
+    if (followCpuQuota) {
+        localLimit = std::clamp<size_t>(CpuQuota::availableCpus(), 1, numJobs);
+        quotaChecked = std::chrono::steady_clock::now();
+    }
+    auto reactor = std::make_shared<ProcessReactor>(numWorkThreads(numJobs));
+    std::vector<std::vector<int>> numaNodes;
+    std::vector<int> cpus;
+    if (placement != Placement::None) {
+        numaNodes = CpuQuota::numaNodes();
+        for (const std::vector<int>& nodeCpus : numaNodes) {
+            cpus.insert(cpus.end(), nodeCpus.begin(), nodeCpus.end());
+        }
+        numNodes = numaNodes.size();
+    }
+    for (size_t i = 0; i < numJobs; i++) {
+        if (cpus.empty()) {
+            executors.push_back(std::make_unique<LocalExecutor>(reactor));
+            continue;
+        }
+
+        /* Pin to the next core, or the CPUs of the next node. */
+        int node = i % numaNodes.size();
+        std::vector<int> pinned = numaNodes[node];
+        if (placement == Placement::Core) {
+            int cpu = cpus[i % cpus.size()];
+            pinned = {cpu};
+            for (size_t n = 0; n < numaNodes.size(); n++) {
+                if (std::find(numaNodes[n].begin(), numaNodes[n].end(),
+                              cpu) != numaNodes[n].end()) {
+                    node = n;
+                }
+            }
+        }
+        executors.push_back(std::make_unique<LocalExecutor>(reactor, pinned));
+        nodes[executors.back().get()] = node;
+    }
+    for (const std::unique_ptr<Executor>& executor : executors) {
+        idle.push_back(executor.get());
+    }
+}
+
+/**
+ * @brief Returns the number of recipes the pool can run at once.
+ *
+ */
+size_t ExecutorPool::size() const { return executors.size(); }
+
+/**
+ * @brief Runs the work on one of the pool's threads, so that e.g. checking
+ * whether a task is outdated, hashing its prerequisites and waiting for an
+ * executor do not hold up the thread that schedules tasks. Work that waits
+ * for an executor holds up other posted work, but never exit handlers, which
+ * return executors.
+ *
+ */
+void ExecutorPool::post(std::function<void()> work) {
+    workQueue.post(std::move(work));
+}
+
+/**
+ * @brief Blocks until an executor is idle and may be lent out, and lends it
+ * out. The executor is returned to the pool when the last copy of the pointer
+ * is destroyed. A pool that follows the CPU quota looks it up again every so
+ * often while lending, so a long build adapts to a resized container.
+ *
+ * @param task Name of the task that borrows the executor, which remembers the
+ * node the task ran on. Empty if not to be remembered.
+ * @param parents Tasks whose node is preferred, by how many ran on it.
+ */
+std::shared_ptr<Executor> ExecutorPool::acquire(
+    const std::string& task, const std::vector<std::string>& parents) {
+    std::unique_lock lock(mutex);
+
+    int preferredNode = -1;
+    if (!nodes.empty()) {
+        std::vector<size_t> numParents(numNodes);
+        for (const std::string& parent : parents) {
+            auto node = taskNodes.find(parent);
+            if (node != taskNodes.end()) {
+                numParents[node->second]++;
+            }
+        }
+        auto most = std::max_element(numParents.begin(), numParents.end());
+        if (most != numParents.end() && *most > 0) {
+            preferredNode = most - numParents.begin();
+        }
+    }
+
+    auto lendable = idle.rend();
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        if (followCpuQuota && now - quotaChecked >= QUOTA_CHECK_INTERVAL) {
+            localLimit = std::clamp<size_t>(CpuQuota::availableCpus(), 1,
+                                            executors.size() - numRemote);
+            quotaChecked = now;
+        }
+
+        /* Local executors are lendable only up to the limit. One on the
+         * preferred node goes first. */
+        auto isLendable = [this](const Executor* executor) {
+            return numLocalBorrowed < localLimit || isRemote(executor);
+        };
+        lendable = std::find_if(
+            idle.rbegin(), idle.rend(), [&](const Executor* executor) {
+                auto node = nodes.find(executor);
+                return isLendable(executor) && node != nodes.end() &&
+                       node->second == preferredNode;
+            });
+        if (lendable == idle.rend()) {
+            lendable = std::find_if(idle.rbegin(), idle.rend(), isLendable);
+        }
+        if (lendable != idle.rend()) {
+            break;
+        }
+        returned.wait_for(lock, QUOTA_CHECK_INTERVAL);
+    }
+
+    Executor* executor = *lendable;
+    idle.erase(std::next(lendable).base());
+    if (!isRemote(executor)) {
+        numLocalBorrowed++;
+    }
+    auto node = nodes.find(executor);
+    if (node != nodes.end() && !task.empty()) {
+        taskNodes[task] = node->second;
+    }
+    return std::shared_ptr<Executor>(executor, [this](Executor* executor) {
+        {
+            std::lock_guard lock(mutex);
+            idle.push_back(executor);
+            if (!isRemote(executor)) {
+                numLocalBorrowed--;
+            }
+        }
+        returned.notify_one();
+    });
+}
+
+/**
+ * @brief Returns the NUMA node that each named task last borrowed a local
+ * executor on. Empty without a placement. Nodes are numbered in order among
+ * those with CPUs this process may use.
+ *
+ */
+std::unordered_map<std::string, int> ExecutorPool::getTaskNodes() {
+    std::lock_guard lock(mutex);
+    return taskNodes;
+}
+
+/**
+ * @brief Returns true if the executor of the pool is a remote one.
+ *
+ */
+bool ExecutorPool::isRemote(const Executor* executor) const {
+    for (size_t i = 0; i < numRemote; i++) {
+        if (executors[i].get() == executor) {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace Worker {
+
+/**
+ * @brief Runs each recipe received on the connection and streams back its
+ * output and exit status. Recipes run in the directory that the connection
+ * named, if any, and fail if it does not exist here. Returns when the
+ * connection is closed.
+ *
+ */
+void serve(int fd) {
+    using RemoteProtocol::Frame;
+
+    Frame type;
+    std::string recipe;
+    std::string directory;
+    while (RemoteProtocol::receiveFrame(fd, type, recipe)) {
+        if (type == Frame::Directory) {
+            directory = recipe;
+            continue;
+        }
+        if (type != Frame::Recipe) {
+            continue;
+        }
+        if (!directory.empty()) {
+            recipe = "cd " + shellQuote(directory) + " || exit\n" + recipe;
+        }
+
+        int stdoutPipe[2];
+        int stderrPipe[2];
+        if (pipe2(stdoutPipe, O_CLOEXEC) != 0) {
+            break;
+        }
+        if (pipe2(stderrPipe, O_CLOEXEC) != 0) {
+            close(stdoutPipe[0]);
+            close(stdoutPipe[1]);
+            break;
+        }
+        pid_t pid = startBash(recipe, stdoutPipe[1], stderrPipe[1]);
+        close(stdoutPipe[1]);
+        close(stderrPipe[1]);
+
+        /* Forward output as it arrives until bash closes both pipes. */
+        pollfd pfds[2] = {
+            {.fd = stdoutPipe[0], .events = POLLIN, .revents = 0},
+            {.fd = stderrPipe[0], .events = POLLIN, .revents = 0}};
+        Frame frames[2] = {Frame::Stdout, Frame::Stderr};
+        bool connected = true;
+        char buf[4096];
+        while (pid != -1 && (pfds[0].fd != -1 || pfds[1].fd != -1)) {
+            if (poll(pfds, 2, -1) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            for (int i = 0; i < 2; i++) {
+                if (pfds[i].fd == -1 || pfds[i].revents == 0) {
+                    continue;
+                }
+                ssize_t len = read(pfds[i].fd, buf, sizeof(buf));
+                if (len > 0) {
+                    connected = connected &&
+                                RemoteProtocol::sendFrame(
+                                    fd, frames[i], std::string(buf, len));
+                } else if (len == 0 || errno != EINTR) {
+                    pfds[i].fd = -1;
+                }
+            }
+        }
+        close(stdoutPipe[0]);
+        close(stderrPipe[0]);
+
+        int status = pid == -1 ? -1 : waitForExit(pid);
+        if (!connected || !RemoteProtocol::sendFrame(fd, Frame::Exit,
+                                                     std::to_string(status))) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+}  // namespace Worker
\ No newline at end of file
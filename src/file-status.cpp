@@ -0,0 +1,274 @@
+#include "file-status.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+/* Number of statx requests submitted to io_uring at once. */
+constexpr unsigned URING_BATCH = 256;
+
+/* Number of threads that look up statuses when io_uring is unavailable. Stats
+ * mostly wait on the file system, so this can exceed the number of cores. */
+constexpr size_t STAT_THREADS = 16;
+
+std::optional<timespec> toModifiedTime(const struct statx& buffer) {
+    return timespec{.tv_sec = buffer.stx_mtime.tv_sec,
+                    .tv_nsec = buffer.stx_mtime.tv_nsec};
+}
+
+std::optional<timespec> statModifiedTime(int directoryFd,
+                                         const std::string& path) {
+    struct statx buffer;
+    if (statx(directoryFd, path.c_str(), 0, STATX_MTIME, &buffer) != 0) {
+        return std::nullopt;
+    }
+    return toModifiedTime(buffer);
+}
+
+/**
+ * @brief Looks up the modified time of each path with batches of statx
+ * requests on an io_uring, so a whole batch costs a single system call. Returns
+ * false if io_uring or its statx operation is unavailable, e.g. because a
+ * seccomp filter blocks it, or if the kernel did not take every request, in
+ * which case the results must be looked up some other way. Interrupted system
+ * calls are retried.
+ *
+ */
+bool statWithIoUring(int directoryFd, const std::vector<std::string>& paths,
+                     std::vector<std::optional<timespec>>& results) {
+    io_uring_params params{};
+    int ringFd = syscall(__NR_io_uring_setup, URING_BATCH, &params);
+    if (ringFd < 0) {
+        return false;
+    }
+
+    size_t sqRingSize =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    size_t sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    void* cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    void* sqesRing = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+    bool success =
+        sqRing != MAP_FAILED && cqRing != MAP_FAILED && sqesRing != MAP_FAILED;
+    if (success) {
+        char* sq = static_cast<char*>(sqRing);
+        unsigned* sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        unsigned sqMask =
+            *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        unsigned* sqArray =
+            reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        io_uring_sqe* sqes = static_cast<io_uring_sqe*>(sqesRing);
+
+        char* cq = static_cast<char*>(cqRing);
+        unsigned* cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        unsigned* cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        unsigned cqMask =
+            *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        io_uring_cqe* cqes =
+            reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        auto buffers = std::make_unique<struct statx[]>(URING_BATCH);
+        for (size_t start = 0; success && start < paths.size();
+             start += URING_BATCH) {
+            /* Queue a statx request for each path in the batch. */
+            unsigned count =
+                std::min<size_t>(URING_BATCH, paths.size() - start);
+            unsigned tail = *sqTail;
+            for (unsigned i = 0; i < count; i++) {
+                unsigned index = (tail + i) & sqMask;
+                io_uring_sqe& sqe = sqes[index];
+                sqe = {};
+                sqe.opcode = IORING_OP_STATX;
+                sqe.fd = directoryFd;
+                sqe.addr =
+                    reinterpret_cast<uintptr_t>(paths[start + i].c_str());
+                sqe.len = STATX_MTIME;
+                sqe.off = reinterpret_cast<uintptr_t>(&buffers[i]);
+                sqe.user_data = i;
+                sqArray[index] = index;
+            }
+            __atomic_store_n(sqTail, tail + count, __ATOMIC_RELEASE);
+
+            /* Submit the batch. The kernel may take only part of it. */
+            unsigned submitted = 0;
+            while (submitted < count) {
+                int taken = syscall(__NR_io_uring_enter, ringFd,
+                                    count - submitted, 0, 0, NULL, 0);
+                if (taken < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (taken <= 0) {
+                    success = false;
+                    break;
+                }
+                submitted += taken;
+            }
+
+            /* Wait for everything submitted to complete, even if the rest
+             * could not be, since the kernel writes into the buffers until
+             * then. */
+            unsigned completed = 0;
+            while (completed < submitted) {
+                unsigned head = *cqHead;
+                if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                    int waited = syscall(__NR_io_uring_enter, ringFd, 0, 1,
+                                         IORING_ENTER_GETEVENTS, NULL, 0);
+                    if (waited < 0 && errno != EINTR && errno != EAGAIN &&
+                        errno != EBUSY) {
+                        /* Requests may still be in flight, so their buffers
+                         * are leaked rather than freed. */
+                        buffers.release();
+                        success = false;
+                        break;
+                    }
+                    continue;
+                }
+
+                const io_uring_cqe& cqe = cqes[head & cqMask];
+                if (cqe.res == -EINVAL) {
+                    /* The kernel does not support statx on io_uring. */
+                    success = false;
+                }
+                size_t i = cqe.user_data;
+                results[start + i] = cqe.res < 0
+                                         ? std::nullopt
+                                         : toModifiedTime(buffers[i]);
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                completed++;
+            }
+        }
+    }
+
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (cqRing != MAP_FAILED) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqesRing != MAP_FAILED) {
+        munmap(sqesRing, sqesSize);
+    }
+    close(ringFd);
+    return success;
+}
+
+/**
+ * @brief Looks up the modified time of each path from a pool of threads.
+ *
+ */
+void statWithThreads(int directoryFd, const std::vector<std::string>& paths,
+                     std::vector<std::optional<timespec>>& results) {
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            results[i] = statModifiedTime(directoryFd, paths[i]);
+        }
+    };
+
+    std::vector<std::jthread> threads;
+    for (size_t i = 0; i < std::min(STAT_THREADS, paths.size()); i++) {
+        threads.emplace_back(worker);
+    }
+}
+
+}  // namespace
+
+FileStatus::FileStatus(const std::string& directory)
+    : directoryFd(AT_FDCWD) {
+    if (!directory.empty()) {
+        /* If the directory cannot be opened, lookups fail as if no file
+         * exists. */
+        directoryFd =
+            open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    }
+}
+
+FileStatus::~FileStatus() {
+    if (directoryFd >= 0) {
+        close(directoryFd);
+    }
+}
+
+/**
+ * @brief Looks up the modified times of all given paths that have not been
+ * looked up yet in one batch. Uses io_uring when the kernel allows it, and
+ * otherwise a pool of threads.
+ *
+ */
+void FileStatus::prefetch(const std::vector<std::string>& paths) {
+    std::vector<std::string> unknownPaths;
+    {
+        std::shared_lock lock(mutex);
+        for (const std::string& path : paths) {
+            if (!modifiedTimes.contains(path)) {
+                unknownPaths.push_back(path);
+            }
+        }
+    }
+    std::sort(unknownPaths.begin(), unknownPaths.end());
+    unknownPaths.erase(std::unique(unknownPaths.begin(), unknownPaths.end()),
+                       unknownPaths.end());
+    if (unknownPaths.empty()) {
+        return;
+    }
+
+    std::vector<std::optional<timespec>> results(unknownPaths.size());
+    if (!statWithIoUring(directoryFd, unknownPaths, results)) {
+        statWithThreads(directoryFd, unknownPaths, results);
+    }
+
+    /* Keep any time that was refreshed while this batch was looked up. */
+    std::unique_lock lock(mutex);
+    for (size_t i = 0; i < unknownPaths.size(); i++) {
+        modifiedTimes.emplace(unknownPaths[i], results[i]);
+    }
+}
+
+/**
+ * @brief Returns the last-modified time of the file at the path, or nothing if
+ * the file does not exist or its status cannot be read. Looks up the file only
+ * if it has not been looked up before.
+ *
+ */
+std::optional<timespec> FileStatus::modifiedTime(const std::string& path) {
+    {
+        std::shared_lock lock(mutex);
+        auto found = modifiedTimes.find(path);
+        if (found != modifiedTimes.end()) {
+            return found->second;
+        }
+    }
+
+    std::optional<timespec> result = statModifiedTime(directoryFd, path);
+    std::unique_lock lock(mutex);
+    return modifiedTimes.emplace(path, result).first->second;
+}
+
+/**
+ * @brief Looks up the file at the path again, e.g. because a recipe may have
+ * just written it.
+ *
+ */
+void FileStatus::refresh(const std::string& path) {
+    std::optional<timespec> result = statModifiedTime(directoryFd, path);
+    std::unique_lock lock(mutex);
+    modifiedTimes[path] = result;
+}
\ No newline at end of file
@@ -1,9 +1,114 @@
+#include <getopt.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cctype>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <tuple>
 
 #include "makefile-builder.h"
 
+namespace {
+
+/* Values for options that only have a long name. */
+enum LongOption {
+    OPT_WATCH = 256,
+    OPT_CACHE_DIR,
+    OPT_CACHE_SIZE,
+    OPT_REMOTE,
+    OPT_ANALYZE,
+    OPT_DURATIONS,
+    OPT_SIMULATE,
+    OPT_PLACEMENT,
+    OPT_SHARD,
+    OPT_PROFILE,
+    OPT_PROFILE_OUTPUT,
+    OPT_CHANGED_FILES,
+    OPT_HELP,
+};
+
+/**
+ * @brief Parses a size in bytes with an optional K, M or G suffix. Throws
+ * std::invalid_argument if the size is malformed.
+ *
+ */
+uintmax_t parseSize(const std::string& size) {
+    size_t end;
+    uintmax_t bytes = std::stoull(size, &end);
+    std::string suffix = size.substr(end);
+    if (suffix == "K") {
+        bytes <<= 10;
+    } else if (suffix == "M") {
+        bytes <<= 20;
+    } else if (suffix == "G") {
+        bytes <<= 30;
+    } else if (!suffix.empty()) {
+        throw std::invalid_argument(size);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Returns true if the argument of `-j` is a number of jobs.
+ *
+ */
+bool isJobCount(const std::string& jobs) {
+    return !jobs.empty() && jobs.size() < 10 &&
+           jobs.find_first_not_of("0123456789") == std::string::npos;
+}
+
+/**
+ * @brief Parses a shard given as `i/n` into its index and the number of
+ * shards. Throws std::invalid_argument unless 1 <= i <= n.
+ *
+ */
+std::pair<size_t, size_t> parseShard(const std::string& shard) {
+    size_t slash = shard.find('/');
+    if (slash == std::string::npos || !isJobCount(shard.substr(0, slash)) ||
+        !isJobCount(shard.substr(slash + 1))) {
+        throw std::invalid_argument(shard);
+    }
+    size_t index = std::stoul(shard.substr(0, slash));
+    size_t numShards = std::stoul(shard.substr(slash + 1));
+    if (index < 1 || index > numShards) {
+        throw std::invalid_argument(shard);
+    }
+    return {index, numShards};
+}
+
+/**
+ * @brief Outputs how to invoke the program, and how to finish a build that was
+ * split into shards.
+ *
+ */
+void printUsage(std::ostream& out, const char* program) {
+    out << "Usage: " << program
+        << " [-C directory] [-f makefile path] [-j [number of targets that can "
+           "build simultaneously|auto]] "
+           "[--watch] "
+           "[--cache-dir=directory] "
+           "[--cache-size=bytes[K|M|G]] "
+           "[--remote=address,...] "
+           "[--analyze[=text|dot|json]] "
+           "[--durations=file] "
+           "[--simulate[=fixed[:seconds]|uniform:min:max|exponential:mean]] "
+           "[--placement=core|numa] "
+           "[--shard=index/count] "
+           "[--profile[=count]] [--profile-output=file] "
+           "[--changed-files=file,...|@list] "
+           "[--help] "
+           "[target...]\n"
+           "A build split with --shard is finished by running the same "
+           "command without --shard once every shard's outputs are in place. "
+           "It only runs the recipes of the goals and of the targets that "
+           "were split up.\n";
+}
+
+}  // namespace
+
 int main(int argc, char *argv[]) {
     /* Enable line buffering for testing. */
     setvbuf(stdout, NULL, _IOLBF, 0);
@@ -11,21 +116,161 @@ int main(int argc, char *argv[]) {
 
     std::string makefilePath = "";
     int concurrency = 1;
+    bool watch = false;
+    std::string analysisFormat;
+    std::string simulatedDistribution;
+    MakefileBuilder::Options options;
     std::vector<std::string> targets;
 
+    const option longOptions[] = {
+        {"watch", no_argument, NULL, OPT_WATCH},
+        {"cache-dir", required_argument, NULL, OPT_CACHE_DIR},
+        {"cache-size", required_argument, NULL, OPT_CACHE_SIZE},
+        {"remote", required_argument, NULL, OPT_REMOTE},
+        {"analyze", optional_argument, NULL, OPT_ANALYZE},
+        {"durations", required_argument, NULL, OPT_DURATIONS},
+        {"simulate", optional_argument, NULL, OPT_SIMULATE},
+        {"placement", required_argument, NULL, OPT_PLACEMENT},
+        {"shard", required_argument, NULL, OPT_SHARD},
+        {"profile", optional_argument, NULL, OPT_PROFILE},
+        {"profile-output", required_argument, NULL, OPT_PROFILE_OUTPUT},
+        {"changed-files", required_argument, NULL, OPT_CHANGED_FILES},
+        {"help", no_argument, NULL, OPT_HELP},
+        {NULL, 0, NULL, 0}};
+
     int opt;
-    while ((opt = getopt(argc, argv, "f:j:")) != -1) {
+    while ((opt = getopt_long(argc, argv, "C:f:j::", longOptions, NULL)) !=
+           -1) {
         switch (opt) {
+            case 'C':
+                if (chdir(optarg) != 0) {
+                    std::cerr << "make: *** " << optarg
+                              << ": No such file or directory.  Stop.\n";
+                    return 1;
+                }
+                break;
             case 'f':
                 makefilePath = optarg;
                 break;
-            case 'j':
-                concurrency = std::stoi(optarg);
+            case 'j': {
+                /* Like GNU make, `-j` without a number does not limit the
+                 * jobs, which here means one per available CPU. */
+                std::string jobs = optarg ? optarg : "";
+                if (!optarg && optind < argc &&
+                    (isJobCount(argv[optind]) ||
+                     std::string(argv[optind]) == "auto")) {
+                    jobs = argv[optind++];
+                }
+                if (jobs.empty() || jobs == "auto") {
+                    options.autoJobs = true;
+                } else if (isJobCount(jobs)) {
+                    concurrency = std::stoi(jobs);
+                    options.autoJobs = false;
+                } else {
+                    std::cerr << "make: invalid number of jobs '" << jobs
+                              << "'\n";
+                    return 1;
+                }
+                break;
+            }
+            case OPT_WATCH:
+                watch = true;
                 break;
+            case OPT_CACHE_DIR:
+                options.cacheDirectory = optarg;
+                break;
+            case OPT_CACHE_SIZE:
+                try {
+                    options.cacheSize = parseSize(optarg);
+                } catch (const std::logic_error&) {
+                    std::cerr << "make: invalid cache size '" << optarg
+                              << "'\n";
+                    return 1;
+                }
+                break;
+            case OPT_REMOTE: {
+                /* A comma-separated list of worker addresses. */
+                std::stringstream addresses(optarg);
+                std::string address;
+                while (std::getline(addresses, address, ',')) {
+                    if (!address.empty()) {
+                        options.remoteAddresses.push_back(address);
+                    }
+                }
+                break;
+            }
+            case OPT_ANALYZE:
+                analysisFormat = optarg ? optarg : "text";
+                break;
+            case OPT_DURATIONS:
+                options.durationsPath = optarg;
+                break;
+            case OPT_SIMULATE:
+                simulatedDistribution = optarg ? optarg : "fixed";
+                break;
+            case OPT_PLACEMENT:
+                options.placement = optarg;
+                if (options.placement != "core" &&
+                    options.placement != "numa") {
+                    std::cerr << "make: invalid placement '" << optarg
+                              << "'\n";
+                    return 1;
+                }
+                break;
+            case OPT_SHARD:
+                try {
+                    std::tie(options.shardIndex, options.numShards) =
+                        parseShard(optarg);
+                } catch (const std::invalid_argument&) {
+                    std::cerr << "make: invalid shard '" << optarg << "'\n";
+                    return 1;
+                }
+                break;
+            case OPT_PROFILE: {
+                std::string count = optarg ? optarg : "10";
+                if (!isJobCount(count)) {
+                    std::cerr << "make: invalid profile count '" << count
+                              << "'\n";
+                    return 1;
+                }
+                options.profileCount = std::stoul(count);
+                break;
+            }
+            case OPT_PROFILE_OUTPUT:
+                options.profilePath = optarg;
+                break;
+            case OPT_CHANGED_FILES: {
+                /* A comma-separated list of files, or `@` and a file that
+                 * lists them separated by whitespace, e.g. a VCS diff. */
+                std::string list = optarg;
+                if (list.starts_with('@')) {
+                    std::ifstream file(list.substr(1));
+                    if (!file) {
+                        std::cerr << "make: *** " << list.substr(1)
+                                  << ": No such file or directory.  Stop.\n";
+                        return 1;
+                    }
+                    list = std::string(std::istreambuf_iterator<char>(file),
+                                       {});
+                    std::replace_if(
+                        list.begin(), list.end(),
+                        [](char c) { return std::isspace(c); }, ',');
+                }
+                std::stringstream files(list);
+                std::string changed;
+                options.changedFiles.emplace();
+                while (std::getline(files, changed, ',')) {
+                    if (!changed.empty()) {
+                        options.changedFiles->push_back(changed);
+                    }
+                }
+                break;
+            }
+            case OPT_HELP:
+                printUsage(std::cout, argv[0]);
+                return 0;
             default:
-                std::cerr << "Usage: " << argv[0]
-                          << " [-f makefile path] [-j number of targets that "
-                             "can build simultaneously] [target...]\n";
+                printUsage(std::cerr, argv[0]);
                 return 1;
         }
     }
@@ -34,7 +279,21 @@ int main(int argc, char *argv[]) {
         targets.push_back(argv[i]);
     }
 
-    MakefileBuilder::build(makefilePath, targets, concurrency);
+    if (!analysisFormat.empty()) {
+        return MakefileBuilder::analyze(makefilePath, targets, analysisFormat,
+                                        options)
+                   ? 0
+                   : 1;
+    } else if (!simulatedDistribution.empty()) {
+        return MakefileBuilder::simulate(makefilePath, targets, concurrency,
+                                         simulatedDistribution, options)
+                   ? 0
+                   : 1;
+    } else if (watch) {
+        MakefileBuilder::watch(makefilePath, targets, concurrency, options);
+    } else {
+        MakefileBuilder::build(makefilePath, targets, concurrency, options);
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -1,28 +1,703 @@
 #include "makefile-builder.h"
 
-#include <sys/wait.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <deque>
+#include <filesystem>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <optional>
+#include <random>
+#include <set>
 #include <string>
+#include <thread>
 
+#include "action-cache.h"
+#include "cpu-quota.h"
+#include "dag-analysis.h"
+#include "executor.h"
 #include "makefile-parser.h"
+#include "resource-profile.h"
+#include "string-ops.h"
 #include "task-graph.h"
 
 namespace MakefileBuilder {
 
+namespace {
+
+/* How long to wait for more file system events after the first one before
+ * rebuilding, so a burst of saves results in a single rebuild. */
+constexpr int WATCH_SETTLE_MS = 100;
+
+/* Exit status of a sub-make that failed, as with GNU make. */
+constexpr int SUB_MAKE_ERROR = 2;
+
+/* Seed of the durations drawn for a simulation, so that it is reproducible. */
+constexpr uint64_t SIMULATION_SEED = 1;
+
+/* Characters that make a recursive make invocation a job for the shell. */
+constexpr const char* SHELL_CHARACTERS = "\"'`$;&|<>()\\*?[]{}~#=\t\n";
+
+bool buildTargets(std::shared_ptr<MakefileParser> parser,
+                  std::shared_ptr<ActionCache> cache,
+                  std::shared_ptr<ExecutorPool> executors,
+                  const std::string& makefilePath,
+                  const std::vector<std::string>& targets,
+                  std::map<std::string, double>* waits = nullptr,
+                  std::shared_ptr<ResourceProfile> profile = nullptr,
+                  bool together = false);
+
+/**
+ * @brief A target whose recipes are being run one after another. The recipes
+ * of a grouped target build every output of its group.
+ *
+ */
+struct RecipeRun {
+    std::shared_ptr<const MakefileSnapshot> snapshot;
+    std::shared_ptr<ActionCache> cache;
+    std::shared_ptr<ExecutorPool> executors;
+    std::shared_ptr<Executor> executor; /* Borrowed while recipes run. */
+    std::string makefilePath;
+    std::string target;
+    std::vector<std::string> parents; /* Tasks the target's task waited on. */
+    std::vector<std::string> outputs;
+    std::vector<std::string> recipes;
+    std::vector<size_t> recipeLinenos;
+    std::vector<std::string> cacheKeys; /* One per output, or none. */
+    std::function<void(bool)> finished; /* Called when the run ends. */
+
+    /* Where to add what each recipe took, if anywhere, and what the recipe
+     * running now took. */
+    std::shared_ptr<ResourceProfile> profile;
+    ResourceUsage usage;
+
+    /* Each output's last-modified time before the recipes ran. */
+    std::vector<std::optional<timespec>> modifiedBefore;
+};
+
+/**
+ * @brief A recursive make invocation, like `$(MAKE) -C subdir target`.
+ *
+ */
+struct SubMake {
+    std::string directory; /* Relative to the invoking make's directory. */
+    std::string makefilePath;
+    std::vector<std::string> targets;
+};
+
+/**
+ * @brief Returns the recursive make invocation the recipe consists of, or
+ * nothing if it is a job for the shell. The recipe must run `$(MAKE)` with
+ * nothing but `-C`, `-f` and `-j` options and targets. `-j` is ignored, since
+ * an in-process sub-make shares the jobs of the make that invoked it.
+ *
+ */
+std::optional<SubMake> parseSubMake(const std::string& recipe) {
+    if (recipe.find_first_of(SHELL_CHARACTERS) != std::string::npos) {
+        return std::nullopt;
+    }
+    std::vector<std::string> words = StringOps::split(recipe, ' ');
+    if (words.empty() || words[0] != MakefileParser::makeCommand()) {
+        return std::nullopt;
+    }
+
+    SubMake subMake;
+    for (size_t i = 1; i < words.size(); i++) {
+        const std::string& word = words[i];
+        if (!word.starts_with('-')) {
+            subMake.targets.push_back(word);
+            continue;
+        }
+
+        /* An option's value is either attached or the next word. */
+        std::string value = word.substr(2);
+        if (word.size() == 2 && word != "-j") {
+            if (++i == words.size()) {
+                return std::nullopt;
+            }
+            value = words[i];
+        } else if (word == "-j" && i + 1 < words.size() &&
+                   (words[i + 1] == "auto" ||
+                    words[i + 1].find_first_not_of("0123456789") ==
+                        std::string::npos)) {
+            /* `-j` takes an optional number of jobs. */
+            i++;
+        }
+        if (word.starts_with("-C")) {
+            subMake.directory =
+                (std::filesystem::path(subMake.directory) / value).string();
+        } else if (word.starts_with("-f")) {
+            subMake.makefilePath = value;
+        } else if (!word.starts_with("-j")) {
+            return std::nullopt;
+        }
+    }
+    return subMake;
+}
+
+/**
+ * @brief Runs a sub-make invoked by a recipe of the run in this process. The
+ * sub-makefile is parsed on its own, and its targets are built on the
+ * executors of the invoking make, so both share the same jobs. Without `-f`,
+ * the sub-make reads `makefile` or `Makefile`. Returns false and outputs an
+ * error message to std::cerr if the sub-make failed.
+ *
+ */
+bool runSubMake(const RecipeRun& run, const SubMake& subMake) {
+    std::string directory =
+        (std::filesystem::path(run.snapshot->getDirectory()) /
+         subMake.directory)
+            .string();
+    std::string makefilePath = subMake.makefilePath;
+    if (makefilePath.empty()) {
+        makefilePath = std::filesystem::exists(
+                           std::filesystem::path(directory) / "makefile")
+                           ? "makefile"
+                           : "Makefile";
+    }
+
+    if (!subMake.directory.empty()) {
+        std::cout << "make: Entering directory '" + directory + "'\n";
+    }
+    bool success = false;
+    try {
+        auto parser = std::make_shared<MakefileParser>(makefilePath, directory);
+        success = buildTargets(parser, nullptr, run.executors, makefilePath,
+                               subMake.targets.empty()
+                                   ? parser->getFirstTargets()
+                                   : subMake.targets,
+                               nullptr, run.profile);
+    } catch (const MakefileParser::MakefileParserException& e) {
+        std::cerr << e.what() << '\n';
+    }
+    if (!subMake.directory.empty()) {
+        std::cout << "make: Leaving directory '" + directory + "'\n";
+    }
+    return success;
+}
+
+/**
+ * @brief Returns the run's executor and reports that the run ended. The run
+ * lets go of the pool first, since it may be destroyed once the run ended,
+ * and the pool must outlive the threads of its own that the run ends on.
+ *
+ */
+void endRun(RecipeRun& run, bool success) {
+    run.executor.reset();
+    run.executors.reset();
+    run.finished(success);
+}
+
+/**
+ * @brief Starts the recipes of the run from the given one on. Each recipe is
+ * started once the one before it exits successfully, from the thread its exit
+ * handler runs on, see `Executor::start`, so no thread waits on a running
+ * recipe. The executor is returned before the run reports that it finished.
+ * A recipe that runs `$(MAKE)` is run as a sub-make in this process, on a
+ * thread of its own and without holding an executor, since the sub-make's
+ * recipes borrow their own.
+ *
+ */
+void runRecipes(std::shared_ptr<RecipeRun> run, size_t next) {
+    /* A recipe that expands to nothing, e.g. one that only calls the file
+     * function, is not run. */
+    while (next < run->recipes.size() &&
+           StringOps::trim(run->recipes[next]).empty()) {
+        next++;
+    }
+
+    if (next == run->recipes.size()) {
+        /* Dependents must see the file the recipes just wrote, or did not. */
+        run->executor.reset();
+        for (size_t i = 0; i < run->outputs.size(); i++) {
+            run->snapshot->restat(run->outputs[i], run->modifiedBefore[i]);
+            if (!run->cacheKeys.empty()) {
+                run->cache->store(run->cacheKeys[i], run->outputs[i]);
+            }
+        }
+        endRun(*run, true);
+        return;
+    }
+
+    /* Print out recipe unless preceded by `@`. */
+    std::string recipe = run->recipes[next];
+    if (recipe.starts_with('@')) {
+        /* Remove `@` from shell command. */
+        recipe = recipe.substr(1);
+    } else {
+        std::cout << recipe << '\n';
+    }
+
+    /* Recipes run as a sub-make hold no executor when they exit, and are not
+     * profiled, as the sub-make's own targets are. */
+    auto onExit = [run, next](int status) {
+        if (run->profile && run->executor && status != -1) {
+            run->profile->add(run->target, run->usage);
+        }
+        if (status == 0) {
+            runRecipes(run, next + 1);
+            return;
+        }
+        if (status != -1) {
+            /* The recipe terminated with an error. */
+            std::cerr << "make: *** [" + run->makefilePath + ":" +
+                             std::to_string(run->recipeLinenos[next]) + ": " +
+                             run->target + "] Error "
+                      << status << '\n';
+        }
+        endRun(*run, false);
+    };
+
+    if (std::optional<SubMake> subMake = parseSubMake(recipe)) {
+        run->executor.reset();
+        std::thread([run, subMake = *subMake, onExit] {
+            onExit(runSubMake(*run, subMake) ? 0 : SUB_MAKE_ERROR);
+        }).detach();
+        return;
+    }
+
+    /* Recipes of a sub-make run in its directory, whose name has no shell
+     * characters. */
+    if (!run->snapshot->getDirectory().empty()) {
+        recipe =
+            "cd '" + run->snapshot->getDirectory() + "' || exit\n" + recipe;
+    }
+    if (!run->executor) {
+        run->executor = run->executors->acquire(run->target, run->parents);
+    }
+    run->executor->start(recipe, onExit,
+                         run->profile ? &run->usage : nullptr);
+}
+
+/**
+ * @brief Runs the recipes of the run's target if it is outdated and cannot be
+ * restored from the cache, on the thread it is called from until a recipe is
+ * started. Outputs that the goal is up to date if its task is the goal's.
+ *
+ */
+void startRun(std::shared_ptr<RecipeRun> run, const std::string& goal,
+              const std::string& goalTask,
+              const std::vector<std::string>& prereqs) {
+    const MakefileSnapshot& snapshot = *run->snapshot;
+
+    /* Don't run if the target is up to date. */
+    if (!snapshot.outdated(run->target)) {
+        if (goalTask == run->target) {
+            std::cout << "make: '" + goal + "' is up to date.\n";
+        }
+        endRun(*run, true);
+        return;
+    }
+
+    /* Expand the recipes now that they are known to run. */
+    try {
+        std::tie(run->recipes, run->recipeLinenos) =
+            snapshot.expandRecipes(run->target);
+    } catch (const MakefileParser::MakefileParserException& e) {
+        std::cerr << e.what() << '\n';
+        endRun(*run, false);
+        return;
+    }
+
+    /* Restore the outputs instead if these recipes already built them from
+     * prerequisites with the same contents. Phony targets have no file to
+     * restore. */
+    bool phony = std::any_of(run->outputs.begin(), run->outputs.end(),
+                             [&](const std::string& output) {
+                                 return snapshot.isPhony(output);
+                             });
+    if (run->cache && !run->recipes.empty() && !phony) {
+        bool restored = true;
+        for (const std::string& output : run->outputs) {
+            run->cacheKeys.push_back(
+                run->cache->key(output, run->recipes, prereqs));
+            restored = restored &&
+                       run->cache->restore(run->cacheKeys.back(), output);
+            if (restored) {
+                snapshot.refreshFileStatus(output);
+            }
+        }
+        if (restored) {
+            std::cout << "make: Restored '" + run->target +
+                             "' from the action cache.\n";
+            endRun(*run, true);
+            return;
+        }
+    }
+
+    /* Run each recipe, one after another on the same executor. */
+    for (const std::string& output : run->outputs) {
+        run->modifiedBefore.push_back(snapshot.modifiedTime(output));
+    }
+    runRecipes(run, 0);
+}
+
+/**
+ * @brief Turns the goal and everything it depends on into a DAG of tasks that
+ * run the recipes of outdated targets on an executor from the pool. Recipes
+ * are only expanded once their target is found to be outdated, so setting up
+ * the DAG costs little when most targets are up to date. Outdated targets are
+ * restored from the cache instead when it is given and holds them. The targets
+ * of a `&:` group share one task, named after the group's first target, so
+ * their recipes run once for all of them. What the recipes take is added to
+ * the profile, if given. Returns false and outputs an error message to
+ * std::cerr if the makefile does not define how to build the goal.
+ *
+ */
+bool createTasks(std::shared_ptr<MakefileParser> parser,
+                 std::shared_ptr<ActionCache> cache,
+                 std::shared_ptr<ExecutorPool> executors,
+                 const std::string& makefilePath, const std::string& goal,
+                 std::vector<TaskGraph::Task>& tasks,
+                 std::shared_ptr<ResourceProfile> profile = nullptr) {
+    std::string goalTask = parser->getGroup(goal).front();
+    std::deque<std::string> taskify = {goalTask};
+    std::set<std::string> seen = {goalTask};
+    std::vector<std::string> targets;
+    std::vector<std::string> paths;
+    size_t firstTask = tasks.size();
+    while (!taskify.empty()) {
+        TaskGraph::Task task{.task = taskify.front()};
+        taskify.pop_front();
+        task.pool = parser->getPool(task.task);
+
+        /* Lookup the prerequisites of every target the task builds. Each
+         * becomes a parent by the task that builds it. Order-only ones are
+         * parents too, but do not go into the cache key. */
+        std::vector<std::string> outputs = parser->getGroup(task.task);
+        try {
+            std::set<std::string> parents;
+            auto addParent = [&](const std::string& prereq) {
+                std::string parent = parser->getGroup(prereq).front();
+                if (parent != task.task && parents.insert(parent).second) {
+                    task.parentTasks.push_back(parent);
+                }
+            };
+            for (const std::string& output : outputs) {
+                for (const std::string& prereq : parser->getPrereqs(output)) {
+                    addParent(prereq);
+                }
+                for (const std::string& prereq :
+                     parser->getOrderOnlyPrereqs(output)) {
+                    addParent(prereq);
+                }
+            }
+        } catch (const MakefileParser::MakefileParserException& e) {
+            std::cerr << e.what() << '\n';
+            return false;
+        }
+        std::copy_if(outputs.begin(), outputs.end(), std::back_inserter(paths),
+                     [&](const std::string& output) {
+                         return !parser->isPhony(output);
+                     });
+        targets.insert(targets.end(), outputs.begin(), outputs.end());
+
+        tasks.push_back(task);
+
+        /* Turn the prerequisites into tasks next, each only once no matter
+         * how many targets depend on it. */
+        for (const std::string& parent : task.parentTasks) {
+            if (seen.insert(parent).second) {
+                taskify.push_back(parent);
+            }
+        }
+    }
+
+    /* Every file that a task may look at is built by a task itself. */
+    parser->prefetchFileStatus(paths);
+
+    /* Tasks start on any thread, so they only see a snapshot of the targets,
+     * taken now that all of them are looked up. */
+    std::shared_ptr<const MakefileSnapshot> snapshot =
+        parser->snapshot(targets);
+    for (size_t i = firstTask; i < tasks.size(); i++) {
+        TaskGraph::Task& task = tasks[i];
+        std::vector<std::string> outputs = snapshot->getGroup(task.task);
+        std::vector<std::string> prereqs;
+        for (const std::string& output : outputs) {
+            const std::vector<std::string>& outputPrereqs =
+                snapshot->getPrereqs(output);
+            prereqs.insert(prereqs.end(), outputPrereqs.begin(),
+                           outputPrereqs.end());
+        }
+
+        /* Create the function that starts the recipes. It is called on the
+         * thread that schedules tasks, so everything that takes time is
+         * posted to the pool's threads. */
+        task.startTask = [snapshot, cache, executors, goal, goalTask, outputs,
+                          prereqs, parents = task.parentTasks, makefilePath,
+                          profile](
+                             const std::string& target,
+                             std::function<void(bool)> finished) {
+            auto run = std::make_shared<RecipeRun>(
+                RecipeRun{.snapshot = snapshot,
+                          .cache = cache,
+                          .executors = executors,
+                          .makefilePath = makefilePath,
+                          .target = target,
+                          .parents = parents,
+                          .outputs = outputs,
+                          .finished = finished,
+                          .profile = profile});
+            executors->post([run, goal, goalTask, prereqs] {
+                startRun(run, goal, goalTask, prereqs);
+            });
+        };
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the given tasks that are, or transitively depend on, one of
+ * the changed tasks. Parents outside of the returned tasks are ignored by
+ * `TaskGraph::run`, so the result can be run on its own.
+ *
+ */
+std::vector<TaskGraph::Task> affectedTasks(
+    const std::vector<TaskGraph::Task>& tasks,
+    const std::set<std::string>& changed) {
+    /* For each task, the other tasks that it is a parent for. */
+    std::map<std::string, std::vector<std::string>> children;
+    for (const TaskGraph::Task& task : tasks) {
+        for (const std::string& parent : task.parentTasks) {
+            children[parent].push_back(task.task);
+        }
+    }
+
+    std::set<std::string> affected;
+    std::deque<std::string> queue(changed.begin(), changed.end());
+    while (!queue.empty()) {
+        std::string current = queue.front();
+        queue.pop_front();
+        for (const std::string& child : children[current]) {
+            if (affected.insert(child).second) {
+                queue.push_back(child);
+            }
+        }
+    }
+
+    std::vector<TaskGraph::Task> result;
+    for (const TaskGraph::Task& task : tasks) {
+        if (affected.contains(task.task) || changed.contains(task.task)) {
+            result.push_back(task);
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Maps a path to the directory that must be watched to see it change
+ * and the file name reported for it by inotify. Directories are watched rather
+ * than files so that files replaced by editors or created later are seen.
+ *
+ */
+std::pair<std::string, std::string> watchLocation(const std::string& path) {
+    std::filesystem::path fsPath(path);
+    std::string directory = fsPath.parent_path().string();
+    return {directory, fsPath.filename().string()};
+}
+
+/**
+ * @brief Returns a function that draws durations in seconds from the
+ * distribution described, one of `fixed[:SECONDS]`, `uniform:MIN:MAX` or
+ * `exponential:MEAN`. Returns nothing if the description is malformed.
+ *
+ */
+std::optional<std::function<double()>> durationDistribution(
+    const std::string& description) {
+    std::vector<std::string> words = StringOps::split(description, ':');
+    std::vector<double> parameters;
+    try {
+        for (size_t i = 1; i < words.size(); i++) {
+            parameters.push_back(std::stod(words[i]));
+        }
+    } catch (const std::logic_error&) {
+        return std::nullopt;
+    }
+
+    auto engine = std::make_shared<std::mt19937_64>(SIMULATION_SEED);
+    std::string name = words.empty() ? "" : words[0];
+    if (name == "fixed" && parameters.size() <= 1) {
+        double seconds = parameters.empty() ? 1 : parameters[0];
+        return [seconds] { return seconds; };
+    } else if (name == "uniform" && parameters.size() == 2 &&
+               parameters[0] <= parameters[1]) {
+        std::uniform_real_distribution<double> distribution(parameters[0],
+                                                            parameters[1]);
+        return [engine, distribution]() mutable {
+            return distribution(*engine);
+        };
+    } else if (name == "exponential" && parameters.size() == 1 &&
+               parameters[0] > 0) {
+        std::exponential_distribution<double> distribution(1 / parameters[0]);
+        return [engine, distribution]() mutable {
+            return distribution(*engine);
+        };
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Returns the action cache described by the options, or nothing if the
+ * cache is disabled.
+ *
+ */
+std::shared_ptr<ActionCache> createCache(const Options& options) {
+    if (options.cacheDirectory.empty()) {
+        return nullptr;
+    }
+    return std::make_shared<ActionCache>(options.cacheDirectory,
+                                         options.cacheSize);
+}
+
+/**
+ * @brief Returns the executors described by the options. With automatic jobs,
+ * there is one local job per CPU this process may be scheduled on, of which
+ * only as many as the cgroup's CPU quota allows are used at a time.
+ *
+ */
+std::shared_ptr<ExecutorPool> createExecutors(size_t numJobs,
+                                              const Options& options) {
+    if (options.autoJobs) {
+        numJobs = CpuQuota::affinityCpus();
+    }
+    ExecutorPool::Placement placement = ExecutorPool::Placement::None;
+    if (options.placement == "core") {
+        placement = ExecutorPool::Placement::Core;
+    } else if (options.placement == "numa") {
+        placement = ExecutorPool::Placement::Numa;
+    }
+    return std::make_shared<ExecutorPool>(numJobs, options.remoteAddresses,
+                                          options.autoJobs, placement);
+}
+
+/**
+ * @brief Outputs how many tasks ran recipes on each NUMA node and how long they
+ * waited for a job after they were ready, given each task's wait. Tasks that
+ * did not run on a local job, e.g. because they were up to date, are left out.
+ *
+ */
+void reportNodeWaits(ExecutorPool& executors,
+                     const std::map<std::string, double>& waits) {
+    std::map<int, std::pair<size_t, double>> nodeWaits;
+    for (const auto& [task, node] : executors.getTaskNodes()) {
+        auto wait = waits.find(task);
+        if (wait != waits.end()) {
+            nodeWaits[node].first++;
+            nodeWaits[node].second += wait->second;
+        }
+    }
+    for (const auto& [node, wait] : nodeWaits) {
+        std::cout << "make: node " << node << ": " << wait.first
+                  << " tasks waited " << wait.second << "s for a job\n";
+    }
+}
+
+/**
+ * @brief Builds the given targets of the parsed makefile one after another,
+ * each as a DAG of tasks. Returns false as soon as one fails, without building
+ * the remaining ones. With `together`, the targets are built as one DAG
+ * instead, so that independent ones build at the same time, e.g. those of a
+ * shard, which need not build in order. If given, `waits` gets how long each
+ * task waited for a job, see `TaskGraph::run`, and `profile` what each recipe
+ * took.
+ *
+ */
+bool buildTargets(std::shared_ptr<MakefileParser> parser,
+                  std::shared_ptr<ActionCache> cache,
+                  std::shared_ptr<ExecutorPool> executors,
+                  const std::string& makefilePath,
+                  const std::vector<std::string>& targets,
+                  std::map<std::string, double>* waits,
+                  std::shared_ptr<ResourceProfile> profile, bool together) {
+    bool success = true;
+    if (together) {
+        std::vector<TaskGraph::Task> tasks;
+        for (const std::string& target : targets) {
+            success = success && createTasks(parser, cache, executors,
+                                             makefilePath, target, tasks,
+                                             profile);
+        }
+        success = success && TaskGraph::run(tasks, executors->size(),
+                                            parser->getPoolDepths(), waits);
+        parser->saveRestatLog();
+        return success;
+    }
+    for (const std::string& currTarget : targets) {
+        /* Turn this target into a DAG of tasks. */
+        std::vector<TaskGraph::Task> tasks;
+        success = createTasks(parser, cache, executors, makefilePath,
+                              currTarget, tasks, profile) &&
+                  TaskGraph::run(tasks, executors->size(),
+                                 parser->getPoolDepths(), waits);
+        if (!success) {
+            break;
+        }
+    }
+    parser->saveRestatLog();
+    return success;
+}
+
+/**
+ * @brief Replaces the goals with the targets that this shard of the build
+ * builds, see `DagAnalysis::shard`. Returns false and outputs an error message
+ * to std::cerr if the makefile does not define how to build a goal.
+ *
+ */
+bool shardTargets(std::shared_ptr<MakefileParser> parser,
+                  const std::string& makefilePath,
+                  std::vector<std::string>& targets, const Options& options) {
+    /* The tasks are only split, so they need no executors. */
+    std::vector<TaskGraph::Task> tasks;
+    std::vector<std::string> goals;
+    for (const std::string& target : targets) {
+        if (!createTasks(parser, nullptr, nullptr, makefilePath, target,
+                         tasks)) {
+            return false;
+        }
+        goals.push_back(parser->getGroup(target).front());
+    }
+
+    std::map<std::string, double> durations;
+    if (!options.durationsPath.empty()) {
+        durations = DagAnalysis::readDurations(options.durationsPath);
+    }
+    targets = DagAnalysis::shard(tasks, goals, options.numShards,
+                                 durations)[options.shardIndex - 1];
+    if (targets.empty()) {
+        std::cout << "make: Nothing to be done for shard " << options.shardIndex
+                  << '/' << options.numShards << ".\n";
+    }
+    return true;
+}
+
+}  // namespace
+
 /**
  * @brief Builds the given targets using the rules defined in the makefile.
  * Returns early and outputs an error message to std::cerr if there is incorrect
  * make syntax or bash exits with an error during a build. For efficiency,
  * builds targets concurrently wherever possible up to the number of jobs
- * allowed.
+ * allowed, or available CPUs with automatic jobs, plus one more for each
+ * remote worker. With an action cache,
+ * outdated targets built before from the same inputs are restored instead of
+ * built, and the cache is trimmed to its size limit afterwards. With a
+ * placement, how long recipes waited for a job on each NUMA node is output
+ * at the end. With a shard, only that shard's part of the targets is built.
+ * With profiling, the targets whose recipes took the longest and the most
+ * memory are output at the end, or what each target took is exported. With
+ * the changed files given, only targets that depend on them are rebuilt, and
+ * no file is looked up to find out which those are.
  *
  */
 void build(const std::string& makefilePath, std::vector<std::string> targets,
-           const size_t numJobs) {
+           const size_t numJobs, const Options& options) {
     /* Parse. */
     std::shared_ptr<MakefileParser> parser;
     try {
@@ -36,97 +711,355 @@ void build(const std::string& makefilePath, std::vector<std::string> targets,
     if (targets.empty()) {
         targets = parser->getFirstTargets();
     }
+    if (options.changedFiles) {
+        parser->setChangedFiles(*options.changedFiles);
+    }
+    if (options.numShards > 0 &&
+        !shardTargets(parser, makefilePath, targets, options)) {
+        return;
+    }
 
-    for (const std::string& currTarget : targets) {
-        /* Turn this target into a DAG of tasks. */
-        std::deque<std::string> taskify = {currTarget};
-        std::vector<TaskGraph::Task> tasks;
-        while (!taskify.empty()) {
-            TaskGraph::Task task{.task = taskify.front()};
-            taskify.pop_front();
-
-            /* Lookup the recipes. */
-            std::vector<std::string> recipes;
-            std::vector<size_t> recipeLinenos;
-            try {
-                task.parentTasks = parser->getPrereqs(task.task);
-                std::tie(recipes, recipeLinenos) =
-                    parser->getRecipes(task.task);
-            } catch (const MakefileParser::MakefileParserException& e) {
-                std::cerr << e.what() << '\n';
-                return;
-            }
-
-            /* Create the recipe-running function. */
-            task.runTask = [parser, currTarget, recipes, recipeLinenos,
-                            makefilePath](const std::string& target) {
-                /* Don't run if the target is up to date. */
-                if (!parser->outdated(target)) {
-                    if (currTarget == target) {
-                        std::cout << "make: '" + target + "' is up to date.\n";
-                    }
-                    return true;
+    std::shared_ptr<ActionCache> cache = createCache(options);
+    std::shared_ptr<ExecutorPool> executors = createExecutors(numJobs, options);
+    std::map<std::string, double> waits;
+    std::shared_ptr<ResourceProfile> profile;
+    if (options.profileCount > 0 || !options.profilePath.empty()) {
+        profile = std::make_shared<ResourceProfile>();
+    }
+    buildTargets(parser, cache, executors, makefilePath, targets,
+                 options.placement.empty() ? nullptr : &waits, profile,
+                 options.numShards > 0);
+    if (cache) {
+        cache->evict();
+    }
+    reportNodeWaits(*executors, waits);
+    if (options.profileCount > 0) {
+        profile->writeTop(std::cout, options.profileCount);
+    }
+    if (!options.profilePath.empty()) {
+        profile->writeFile(options.profilePath);
+    }
+}
+
+/**
+ * @brief Builds the given targets, then stays resident and rebuilds them
+ * whenever the makefile or a file they depend on changes. The parsed makefile,
+ * its remembered file statuses and each target's DAG are kept between rebuilds,
+ * and only the changed files are looked up again. A rebuild only runs the
+ * tasks that depend on a changed file, so its cost scales with the size of the
+ * change. A changed makefile is parsed again from scratch. Only files that no
+ * recipe creates are watched, so a rebuild never triggers another one. Returns
+ * only if the watch cannot be set up.
+ *
+ */
+void watch(const std::string& makefilePath, std::vector<std::string> targets,
+           const size_t numJobs, const Options& options) {
+    int inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (inotifyFd == -1) {
+        perror("inotify_init1 failed");
+        return;
+    }
+
+    /* Directory being watched for each watch descriptor. */
+    std::map<int, std::string> watchedDirectories;
+    /* Paths whose changes trigger a rebuild, keyed by watched location. */
+    std::set<std::pair<std::string, std::string>> watchedFiles;
+
+    std::shared_ptr<ActionCache> cache = createCache(options);
+    std::shared_ptr<ExecutorPool> executors = createExecutors(numJobs, options);
+    std::shared_ptr<MakefileParser> parser;
+    std::vector<std::string> goals;
+    std::vector<std::vector<TaskGraph::Task>> goalTasks;
+
+    /* Parse the makefile and turn every goal into a DAG of tasks. Returns
+     * false if the makefile is invalid, in which case the previous state is
+     * kept. */
+    auto load = [&]() {
+        std::shared_ptr<MakefileParser> newParser;
+        try {
+            newParser = std::make_shared<MakefileParser>(makefilePath);
+        } catch (const MakefileParser::MakefileParserException& e) {
+            std::cerr << e.what() << '\n';
+            return false;
+        }
+
+        std::vector<std::string> newGoals =
+            targets.empty() ? newParser->getFirstTargets() : targets;
+        std::vector<std::vector<TaskGraph::Task>> newGoalTasks;
+        for (const std::string& goal : newGoals) {
+            newGoalTasks.emplace_back();
+            if (!createTasks(newParser, cache, executors, makefilePath, goal,
+                             newGoalTasks.back())) {
+                return false;
+            }
+        }
+
+        parser = newParser;
+        goals = newGoals;
+        goalTasks = newGoalTasks;
+        return true;
+    };
+
+    /* Watch the makefile and every file that no recipe creates. Directories
+     * that are already watched keep their watches, so changes queued while
+     * building are not lost, and only the difference is added or removed. */
+    auto subscribe = [&]() {
+        watchedFiles.clear();
+        std::set<std::string> paths = {makefilePath};
+        for (const std::vector<TaskGraph::Task>& tasks : goalTasks) {
+            for (const TaskGraph::Task& task : tasks) {
+                if (!parser->hasRecipes(task.task) &&
+                    !parser->isPhony(task.task)) {
+                    paths.insert(task.task);
                 }
-                /* Run each recipe of the target. */
-                for (size_t i = 0; i < recipes.size(); i++) {
-                    std::string recipe = recipes.at(i);
-                    size_t lineno = recipeLinenos.at(i);
-                    pid_t pid = fork();
-                    if (pid == -1) {
-                        perror("fork failed");
-                        return false;
-                    } else if (pid == 0) {
-                        /* Print out recipe unless preceded by `@`. */
-                        if (recipe.starts_with('@')) {
-                            /* Remove `@` from shell command. */
-                            recipe = recipe.substr(1);
-                        } else {
-                            std::cout << recipe << '\n';
-                        }
-
-                        /* Run recipe in child process. */
-                        const char* argv[] = {"bash", "-c", recipe.c_str(),
-                                              NULL};
-                        execvp(argv[0], const_cast<char* const*>(argv));
-
-                        /* Execvp only returns if an error occurred. */
-                        perror("execvp failed");
-                        return false;
-                    } else {
-                        /* Wait before going to next recipe in the parent
-                         * process. */
-                        int status;
-                        if (waitpid(pid, &status, 0) == -1) {
-                            perror("waitpid failed");
-                            return false;
-                        }
-                        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-                            /* The child process terminated with an error. */
-                            std::cerr << "make: *** [" + makefilePath + ":" +
-                                             std::to_string(lineno) + ": " +
-                                             target + "] Error "
-                                      << WEXITSTATUS(status) << '\n';
-                            return false;
-                        }
-                    }
+            }
+        }
+
+        std::set<std::string> directories;
+        for (const std::string& path : paths) {
+            watchedFiles.insert(watchLocation(path));
+            directories.insert(watchLocation(path).first);
+        }
+        for (auto it = watchedDirectories.begin();
+             it != watchedDirectories.end();) {
+            if (directories.contains(it->second)) {
+                directories.erase(it->second);
+                it++;
+            } else {
+                inotify_rm_watch(inotifyFd, it->first);
+                it = watchedDirectories.erase(it);
+            }
+        }
+        for (const std::string& directory : directories) {
+            int wd = inotify_add_watch(
+                inotifyFd, directory.empty() ? "." : directory.c_str(),
+                IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_CREATE |
+                    IN_DELETE);
+            if (wd == -1) {
+                perror(("inotify_add_watch failed for " + directory).c_str());
+                continue;
+            }
+            watchedDirectories[wd] = directory;
+        }
+    };
+
+    /* Block until at least one watched file changes, then collect every
+     * change that arrives before things settle down, including those queued
+     * during the last build, so they are merged into the next one. */
+    auto waitForChanges = [&]() {
+        std::set<std::string> changed;
+        alignas(inotify_event) char buf[4096];
+        int timeout = -1;
+        while (true) {
+            pollfd pfd = {.fd = inotifyFd, .events = POLLIN, .revents = 0};
+            int ready = poll(&pfd, 1, timeout);
+            if (ready == -1 && errno != EINTR) {
+                perror("poll failed");
+                return changed;
+            }
+            if (ready <= 0) {
+                if (!changed.empty()) {
+                    return changed;
                 }
-                return true;
-            };
+                continue;
+            }
 
-            tasks.push_back(task);
+            ssize_t len = read(inotifyFd, buf, sizeof(buf));
+            for (char* ptr = buf; len > 0 && ptr < buf + len;) {
+                inotify_event* event = reinterpret_cast<inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+                if (event->len == 0 ||
+                    !watchedDirectories.contains(event->wd)) {
+                    continue;
+                }
+                std::pair<std::string, std::string> location = {
+                    watchedDirectories[event->wd], event->name};
+                if (!watchedFiles.contains(location)) {
+                    continue;
+                }
+                changed.insert(
+                    (std::filesystem::path(location.first) / location.second)
+                        .string());
+            }
+            if (!changed.empty()) {
+                timeout = WATCH_SETTLE_MS;
+            }
+        }
+    };
 
-            /* Turn the prerequisites into tasks next. */
-            taskify.insert(taskify.end(), task.parentTasks.begin(),
-                           task.parentTasks.end());
+    /* Builds the goals, only the tasks affected by the changed files if
+     * given. Wildcard and shell results from the last build may be stale. */
+    auto runGoals = [&](const std::set<std::string>* changed) {
+        if (changed) {
+            for (const std::string& path : *changed) {
+                parser->refreshFileStatus(path);
+            }
+            parser->clearFunctionCache();
         }
+        for (size_t i = 0; i < goals.size(); i++) {
+            std::vector<TaskGraph::Task> tasks =
+                changed ? affectedTasks(goalTasks[i], *changed) : goalTasks[i];
+            if (!tasks.empty() &&
+                !TaskGraph::run(tasks, executors->size(),
+                                parser->getPoolDepths())) {
+                break;
+            }
+        }
+        parser->saveRestatLog();
+        if (cache) {
+            cache->evict();
+        }
+    };
 
-        /* Run the tasks to build this target. If one target fails, do not build
-         * any remaining targets. */
-        bool success = TaskGraph::run(tasks, numJobs);
-        if (!success) {
+    /* If the makefile is invalid there is nothing to build yet, but keep
+     * watching the makefile. */
+    bool loaded = load();
+    subscribe();
+    if (loaded) {
+        runGoals(nullptr);
+    }
+
+    while (true) {
+        std::cout << "make: Watching " << watchedFiles.size()
+                  << " files for changes.\n";
+        std::set<std::string> changed = waitForChanges();
+        if (changed.empty()) {
+            close(inotifyFd);
             return;
         }
+
+        bool makefileChanged = changed.contains(
+            (std::filesystem::path(watchLocation(makefilePath).first) /
+             watchLocation(makefilePath).second)
+                .string());
+        if (makefileChanged || !parser) {
+            /* Everything may have changed, so start over. */
+            if (load()) {
+                subscribe();
+                runGoals(nullptr);
+            }
+        } else {
+            runGoals(&changed);
+        }
+    }
+}
+
+/**
+ * @brief Turns the given targets and everything they depend on into one DAG
+ * without building anything, and writes an analysis of its parallelism to
+ * std::cout. The format is `text` for people, or `dot` or `json` to also
+ * include the DAG for other tools. Returns false and outputs an error message
+ * to std::cerr if the format is unknown or the makefile is invalid.
+ *
+ */
+bool analyze(const std::string& makefilePath, std::vector<std::string> targets,
+             const std::string& format, const Options& options) {
+    if (format != "text" && format != "dot" && format != "json") {
+        std::cerr << "make: invalid analysis format '" << format << "'\n";
+        return false;
     }
+
+    std::shared_ptr<MakefileParser> parser;
+    try {
+        parser = std::make_shared<MakefileParser>(makefilePath);
+    } catch (const MakefileParser::MakefileParserException& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    }
+    if (targets.empty()) {
+        targets = parser->getFirstTargets();
+    }
+
+    /* The tasks are never run, so they need no executors. Tasks shared by
+     * several targets are ignored the second time by the analysis. */
+    std::vector<TaskGraph::Task> tasks;
+    for (const std::string& target : targets) {
+        if (!createTasks(parser, nullptr, nullptr, makefilePath, target,
+                         tasks)) {
+            return false;
+        }
+    }
+
+    std::map<std::string, double> durations;
+    if (!options.durationsPath.empty()) {
+        durations = DagAnalysis::readDurations(options.durationsPath);
+    }
+    DagAnalysis::Report report = DagAnalysis::analyze(tasks, durations);
+    if (format == "dot") {
+        DagAnalysis::writeDot(std::cout, tasks, report);
+    } else if (format == "json") {
+        DagAnalysis::writeJson(std::cout, tasks, report);
+    } else {
+        DagAnalysis::writeText(std::cout, report);
+    }
+    return true;
+}
+
+/**
+ * @brief Simulates building the given targets on a virtual clock instead of
+ * running any recipe, and outputs how long the build would take with the
+ * given number of jobs and how busy the jobs would be. Every target is taken
+ * to be outdated. Targets take their recorded duration if there is one, or
+ * else one drawn from the distribution, see `durationDistribution`. Returns
+ * false and outputs an error message to std::cerr if the makefile or the
+ * distribution is invalid.
+ *
+ */
+bool simulate(const std::string& makefilePath,
+              std::vector<std::string> targets, const size_t numJobs,
+              const std::string& distribution, const Options& options) {
+    std::optional<std::function<double()>> draw =
+        durationDistribution(distribution);
+    if (!draw) {
+        std::cerr << "make: invalid duration distribution '" << distribution
+                  << "'\n";
+        return false;
+    }
+
+    std::shared_ptr<MakefileParser> parser;
+    try {
+        parser = std::make_shared<MakefileParser>(makefilePath);
+    } catch (const MakefileParser::MakefileParserException& e) {
+        std::cerr << e.what() << '\n';
+        return false;
+    }
+    if (targets.empty()) {
+        targets = parser->getFirstTargets();
+    }
+
+    std::vector<TaskGraph::Task> tasks;
+    for (const std::string& target : targets) {
+        if (!createTasks(parser, nullptr, nullptr, makefilePath, target,
+                         tasks)) {
+            return false;
+        }
+    }
+
+    std::map<std::string, double> durations;
+    if (!options.durationsPath.empty()) {
+        durations = DagAnalysis::readDurations(options.durationsPath);
+    }
+    auto duration = [&](const std::string& task) {
+        auto recorded = durations.find(task);
+        return recorded != durations.end() ? recorded->second : (*draw)();
+    };
+
+    /* There are as many slots as an executor pool would have. */
+    size_t numLocal = options.autoJobs ? CpuQuota::availableCpus() : numJobs;
+    if (numLocal == 0 && options.remoteAddresses.empty()) {
+        numLocal = 1;
+    }
+    size_t numSlots = numLocal + options.remoteAddresses.size();
+    TaskGraph::Simulation simulation = TaskGraph::simulate(
+        tasks, numSlots, duration, parser->getPoolDepths());
+
+    std::cout << "tasks: " << simulation.numTasks << '\n';
+    std::cout << "jobs: " << numSlots << '\n';
+    std::cout << "makespan: " << simulation.makespan << '\n';
+    std::cout << "busy time: " << simulation.busyTime << '\n';
+    std::cout << "idle slot time: " << simulation.idleTime << '\n';
+    std::cout << "utilization: " << simulation.utilization * 100 << "%\n";
+    return simulation.complete;
 }
 
 }  // namespace MakefileBuilder
\ No newline at end of file
@@ -1,20 +1,147 @@
 #include "makefile-parser.h"
 
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cassert>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <numeric>
-#include <queue>
 #include <set>
 #include <string>
 
+#include "makefile-snapshot.h"
 #include "string-ops.h"
 #include "variables.h"
 
+namespace {
+
+/* How many pattern rules may be chained to build a single target. */
+constexpr size_t MAX_PATTERN_CHAIN = 4;
+
+/* Where the restat log is kept, relative to the working directory. */
+constexpr const char* RESTAT_LOG_PATH = ".minimake_restat";
+
+/**
+ * @brief Replaces the first `%` of a pattern with the stem. Patterns without a
+ * `%` are returned unchanged.
+ *
+ */
+std::string substituteStem(const std::string& pattern,
+                           const std::string& stem) {
+    size_t percentPos = pattern.find('%');
+    if (percentPos == std::string::npos) {
+        return pattern;
+    }
+    return pattern.substr(0, percentPos) + stem +
+           pattern.substr(percentPos + 1);
+}
+
+/* The targets and prerequisites of each rule in a dependency file. */
+using DepfileRules = std::vector<
+    std::tuple<std::vector<std::string>, std::vector<std::string>>>;
+
+/**
+ * @brief Scans the contents of a dependency file into its rules. Understands
+ * line continuations, `$$`, and spaces and `#` escaped by a backslash. Returns
+ * false as soon as it finds anything else that a general makefile may contain,
+ * such as recipes, variables, pattern rules or comments.
+ *
+ */
+bool scanDepfile(const char* data, size_t size, DepfileRules& rules) {
+    std::vector<std::string> targets;
+    std::vector<std::string> prereqs;
+    std::string word;
+    bool inPrereqs = false;
+    bool atLineStart = true;
+
+    auto endWord = [&]() {
+        if (!word.empty()) {
+            (inPrereqs ? prereqs : targets).push_back(word);
+            word.clear();
+        }
+    };
+
+    /* Words without a colon do not form a rule. */
+    auto endLine = [&]() {
+        endWord();
+        if (!inPrereqs) {
+            return targets.empty();
+        }
+        rules.emplace_back(std::move(targets), std::move(prereqs));
+        targets.clear();
+        prereqs.clear();
+        inPrereqs = false;
+        return true;
+    };
+
+    for (size_t i = 0; i < size; i++) {
+        char c = data[i];
+        char next = i + 1 < size ? data[i + 1] : '\0';
+        if (c == '\t' && atLineStart) {
+            return false;
+        }
+        atLineStart = c == '\n';
+
+        switch (c) {
+            case '\\':
+                if (next == '\n') {
+                    /* Line continuation. */
+                    endWord();
+                    i++;
+                } else if (next == '\r' && i + 2 < size &&
+                           data[i + 2] == '\n') {
+                    endWord();
+                    i += 2;
+                } else if (next == ' ' || next == '#') {
+                    word += next;
+                    i++;
+                } else {
+                    word += c;
+                }
+                break;
+            case '$':
+                if (next != '$') {
+                    return false;
+                }
+                word += '$';
+                i++;
+                break;
+            case ' ':
+            case '\t':
+            case '\r':
+                endWord();
+                break;
+            case '\n':
+                if (!endLine()) {
+                    return false;
+                }
+                break;
+            case ':':
+                endWord();
+                if (inPrereqs || targets.empty()) {
+                    return false;
+                }
+                inPrereqs = true;
+                break;
+            case '#':
+            case '=':
+            case '%':
+            case '|':
+                return false;
+            default:
+                word += c;
+        }
+    }
+    return endLine();
+}
+
+}  // namespace
+
 /**
  * @brief Finds each target's recipes and prerequisites. Throws an error for
  *      - an unopenable file
@@ -23,21 +150,48 @@
  *      - a variable with no name
  *      - a target that depends on itself
  *      - a rule with no targets
+ *      - a rule that mixes pattern and normal targets
+ *      - an included file that does not exist
+ *      - a malformed pool declaration, or a target assigned to an undeclared
+ *        pool
+ *      - a target-specific variable for a pattern target
+ *      - a grouped rule with pattern targets
  *
- * Allows redefinition of variables and a target's recipes.
+ * Allows redefinition of variables and a target's recipes. Paths in the
+ * makefile are relative to the given directory, the working directory by
+ * default, as for a sub-make run with `-C`.
+ *
+ */
+MakefileParser::MakefileParser(std::string makefilePath,
+                               std::string directory)
+    : makefilePath(makefilePath),
+      directory(directory),
+      fileStatus(directory) {
+    /* Hardcode special case variables. */
+    makefileVars.addVariable("$", "$", 0);
+    makefileVars.addVariable("MAKE", makeCommand(), 0);
+    makefileVars.setDirectory(directory);
+
+    parseMakefile(makefilePath);
+
+    if (!restatTargets.empty()) {
+        restatLog.load(resolve(RESTAT_LOG_PATH));
+    }
+}
+
+/**
+ * @brief Adds the rules and variables defined in a makefile, which is either
+ * the parsed makefile or one that it includes. Error messages name this
+ * makefile.
  *
  */
-MakefileParser::MakefileParser(std::string makefilePath)
-    : makefilePath(makefilePath) {
-    std::ifstream makefile(makefilePath);
+void MakefileParser::parseMakefile(const std::string& makefilePath) {
+    std::ifstream makefile(resolve(makefilePath));
     if (!makefile) {
         throw MakefileParserException("make: %s No such file or directory",
                                       makefilePath.c_str());
     }
 
-    /* Hardcode a special case variable. */
-    makefileVars.addVariable("$", "$", 0);
-
     std::string line;
     size_t lineno = 0;
 
@@ -45,6 +199,10 @@ MakefileParser::MakefileParser(std::string makefilePath)
      * inside. When there are no targets, we are not in a rule definition. */
     std::vector<std::string> definedTargets;
     size_t definedLineno = 0;
+
+    /* The pattern rules whose definition we are currently inside, if the
+     * current rule has pattern targets. */
+    std::vector<size_t> definedPatternRules;
     while (std::getline(makefile, line)) {
         lineno++;
 
@@ -55,22 +213,111 @@ MakefileParser::MakefileParser(std::string makefilePath)
         }
 
         /* Identify the line type. Order matters. Tabs are evaluated before
-         * separators. A blank line is checked before anything else. */
+         * separators. A blank line is checked before anything else. A colon
+         * that is part of a `:=` or `::=` operator does not start a rule. */
         bool isRecipe = line.starts_with('\t');
         size_t equalPos = line.find('=');
         size_t colonPos = line.find(':');
-        bool isVariable = equalPos < colonPos;
-        bool isRule = colonPos < equalPos;
+        bool isSimpleAssignment =
+            colonPos != std::string::npos &&
+            (line.compare(colonPos, 2, ":=") == 0 ||
+             line.compare(colonPos, 3, "::=") == 0);
+        bool isVariable = equalPos < colonPos || isSimpleAssignment;
+        bool isRule = colonPos < equalPos && !isSimpleAssignment;
         line = StringOps::trim(line);
         bool isNoOp = line.empty();
+        std::string directive = line.substr(0, line.find_first_of(" \t"));
+        bool isInclude =
+            !isRecipe && equalPos == std::string::npos &&
+            (directive == "include" || directive == "-include" ||
+             directive == "sinclude");
+        bool isPool = !isRecipe && equalPos == std::string::npos &&
+                      colonPos == std::string::npos && directive == "pool";
 
         if (isNoOp) {
             continue;
+        } else if (isInclude) {
+            definedTargets.clear();
+            definedPatternRules.clear();
+
+            std::string includeString;
+            try {
+                includeString = makefileVars.expandVariables(
+                    line.substr(directive.size()), lineno);
+            } catch (const Variables::VariablesException& e) {
+                throw MakefileParserException("%s:%s", makefilePath.c_str(),
+                                              e.what());
+            }
+
+            /* Each word is a glob pattern. A missing file is an error unless
+             * the directive is `-include` or `sinclude`. */
+            bool optional = directive != "include";
+            for (const std::string& pattern :
+                 StringOps::split(includeString, ' ')) {
+                glob_t matches;
+                int result =
+                    glob(resolve(pattern).c_str(), 0, NULL, &matches);
+                std::vector<std::string> paths;
+                for (size_t i = 0; result == 0 && i < matches.gl_pathc; i++) {
+                    /* Keep paths relative to the makefile's directory. */
+                    std::string path = matches.gl_pathv[i];
+                    if (!directory.empty() && pattern.front() != '/') {
+                        path.erase(0, resolve("").size());
+                    }
+                    paths.push_back(path);
+                }
+                globfree(&matches);
+
+                bool isGlob =
+                    pattern.find_first_of("*?[") != std::string::npos;
+                if (paths.empty() && !isGlob && !optional) {
+                    throw MakefileParserException(
+                        "%s:%d: %s: No such file or directory",
+                        makefilePath.c_str(), lineno, pattern.c_str());
+                }
+                for (const std::string& path : paths) {
+                    if (!parseDepfile(path)) {
+                        parseMakefile(path);
+                    }
+                }
+            }
+        } else if (isPool) {
+            definedTargets.clear();
+            definedPatternRules.clear();
+
+            /* A `pool NAME DEPTH` line limits how many targets assigned to
+             * the pool may build at once. */
+            std::vector<std::string> words;
+            try {
+                words = StringOps::split(
+                    makefileVars.expandVariables(
+                        line.substr(directive.size()), lineno),
+                    ' ');
+            } catch (const Variables::VariablesException& e) {
+                throw MakefileParserException("%s:%s", makefilePath.c_str(),
+                                              e.what());
+            }
+            bool validDepth = words.size() == 2 && words[1].size() < 10 &&
+                              words[1].find_first_not_of("0123456789") ==
+                                  std::string::npos &&
+                              std::stoul(words[1]) > 0;
+            if (!validDepth) {
+                throw MakefileParserException(
+                    "%s:%d: *** invalid pool declaration.  Stop.",
+                    makefilePath.c_str(), lineno);
+            }
+            poolDepths[words[0]] = std::stoul(words[1]);
         } else if (isRecipe) {
             if (definedTargets.empty()) {
                 throw MakefileParserException(
                     "%s:%d: *** recipe commences before first target.  Stop.",
                     makefilePath.c_str(), lineno);
+            } else if (!definedPatternRules.empty()) {
+                /* Assign recipe to each pattern rule. */
+                for (size_t rule : definedPatternRules) {
+                    patternRules[rule].recipes.push_back(line);
+                    patternRules[rule].recipeLinenos.push_back(lineno);
+                }
             } else {
                 /* Assign recipe to each target. */
                 for (const std::string& target : definedTargets) {
@@ -98,29 +345,9 @@ MakefileParser::MakefileParser(std::string makefilePath)
             }
         } else if (isVariable) {
             definedTargets.clear();
+            definedPatternRules.clear();
 
-            /* Expand variables in the variable's name. */
-            size_t equalPos = line.find('=');
-            assert(equalPos != std::string::npos);
-            std::string varName = line.substr(0, equalPos);
-            try {
-                varName = makefileVars.expandVariables(varName, lineno);
-            } catch (const Variables::VariablesException& e) {
-                throw MakefileParserException("%s:%s", makefilePath.c_str(),
-                                              e.what());
-            }
-            varName = StringOps::trim(varName);
-
-            /* Error on an empty variable name. */
-            if (varName.empty()) {
-                throw MakefileParserException(
-                    "%s:%d: *** empty variable name.  Stop.",
-                    makefilePath.c_str(), lineno);
-            }
-
-            /* Assign value to the variable name. */
-            std::string varValue = StringOps::trim(line.substr(equalPos + 1));
-            makefileVars.addVariable(varName, varValue, lineno);
+            assignVariable(makefileVars, line, lineno, makefilePath);
         } else if (isRule) {
             /* Expand variables in the rule. Expansion may introduce a colon, so
              * colon-separate targets from prerequisites first. */
@@ -131,16 +358,48 @@ MakefileParser::MakefileParser(std::string makefilePath)
             try {
                 targetString = makefileVars.expandVariables(
                     line.substr(0, colonPos), lineno);
-                prereqString = makefileVars.expandVariables(
-                    line.substr(colonPos + 1), lineno);
+                if (equalPos == std::string::npos) {
+                    prereqString = makefileVars.expandVariables(
+                        line.substr(colonPos + 1), lineno);
+                }
             } catch (const Variables::VariablesException& e) {
                 throw MakefileParserException("%s:%s", makefilePath.c_str(),
                                               e.what());
             }
 
+            /* A `&:` separator makes the targets a group, all of which one
+             * run of the recipes builds. */
+            targetString = StringOps::trim(targetString);
+            bool isGrouped = targetString.ends_with('&');
+            if (isGrouped) {
+                targetString.pop_back();
+            }
+
             definedTargets = StringOps::split(targetString, ' ');
             definedLineno = lineno;
 
+            /* A `target: VAR = value` line assigns a variable in the scope of
+             * each target instead of defining a rule. */
+            bool isTargetVariable = equalPos != std::string::npos;
+            if (isTargetVariable) {
+                std::vector<std::string> targets;
+                targets.swap(definedTargets);
+                definedPatternRules.clear();
+                for (const std::string& target : targets) {
+                    if (target.find('%') != std::string::npos) {
+                        throw MakefileParserException(
+                            "%s:%d: *** pattern-specific variables are not "
+                            "supported.  Stop.",
+                            makefilePath.c_str(), lineno);
+                    }
+                    auto [scope, added] = targetVariables.try_emplace(
+                        target, &makefileVars);
+                    assignVariable(scope->second, line.substr(colonPos + 1),
+                                   lineno, makefilePath);
+                }
+                continue;
+            }
+
             /* Error on an empty set of targets. */
             if (definedTargets.empty()) {
                 throw MakefileParserException(
@@ -148,14 +407,89 @@ MakefileParser::MakefileParser(std::string makefilePath)
                     lineno);
             }
 
-            /* Assign prereqs to each target. */
+            /* Assign prereqs to each target. Those after a `|` are
+             * order-only. */
+            std::vector<std::string> newOrderOnlyPrereqs;
+            size_t barPos = prereqString.find('|');
+            if (barPos != std::string::npos) {
+                newOrderOnlyPrereqs =
+                    StringOps::split(prereqString.substr(barPos + 1), ' ');
+                prereqString.erase(barPos);
+            }
             std::vector<std::string> newPrereqs =
                 StringOps::split(prereqString, ' ');
 
+            /* A `.POOL.NAME` rule assigns its prerequisites to the pool
+             * instead of defining a target. */
+            if (definedTargets.size() == 1 &&
+                definedTargets[0].starts_with(".POOL.")) {
+                std::string pool = definedTargets[0].substr(6);
+                definedTargets.clear();
+                if (!poolDepths.contains(pool)) {
+                    throw MakefileParserException(
+                        "%s:%d: *** unknown pool '%s'.  Stop.",
+                        makefilePath.c_str(), lineno, pool.c_str());
+                }
+                for (const std::string& target : newPrereqs) {
+                    targetPools[target] = pool;
+                }
+                continue;
+            }
+
+            /* A `.RESTAT` rule marks its prerequisites as targets whose
+             * recipes may leave them unmodified. */
+            if (definedTargets.size() == 1 && definedTargets[0] == ".RESTAT") {
+                definedTargets.clear();
+                restatTargets.insert(newPrereqs.begin(), newPrereqs.end());
+                continue;
+            }
+
+            /* A `.PHONY` rule marks its prerequisites as targets that are
+             * not files, so they are always built and never looked up. */
+            if (definedTargets.size() == 1 && definedTargets[0] == ".PHONY") {
+                definedTargets.clear();
+                phonyTargets.insert(newPrereqs.begin(), newPrereqs.end());
+                continue;
+            }
+
+            /* Pattern rules are only matched against targets when a target
+             * without recipes is looked up. */
+            definedPatternRules.clear();
+            size_t numPatterns = std::count_if(
+                definedTargets.begin(), definedTargets.end(),
+                [](const std::string& target) {
+                    return target.find('%') != std::string::npos;
+                });
+            if (numPatterns > 0) {
+                if (isGrouped) {
+                    throw MakefileParserException(
+                        "%s:%d: *** grouped pattern rules are not supported.  "
+                        "Stop.",
+                        makefilePath.c_str(), lineno);
+                }
+                if (numPatterns != definedTargets.size()) {
+                    throw MakefileParserException(
+                        "%s:%d: *** mixed implicit and normal rules.  Stop.",
+                        makefilePath.c_str(), lineno);
+                }
+                for (const std::string& target : definedTargets) {
+                    definedPatternRules.push_back(patternRules.size());
+                    addPatternRule(target, newPrereqs, newOrderOnlyPrereqs);
+                }
+                continue;
+            }
+
             for (const std::string& target : definedTargets) {
                 for (const std::string& newPrereq : newPrereqs) {
                     makefilePrereqs[target].push_back(newPrereq);
                 }
+                if (!newOrderOnlyPrereqs.empty()) {
+                    std::vector<std::string>& orderOnly =
+                        makefileOrderOnlyPrereqs[target];
+                    orderOnly.insert(orderOnly.end(),
+                                     newOrderOnlyPrereqs.begin(),
+                                     newOrderOnlyPrereqs.end());
+                }
 
                 /* Do not duplicate any prereqs. */
                 std::sort(makefilePrereqs[target].begin(),
@@ -166,6 +500,12 @@ MakefileParser::MakefileParser(std::string makefilePath)
                     makefilePrereqs[target].end());
             }
 
+            if (isGrouped) {
+                for (const std::string& target : definedTargets) {
+                    groupedTargets[target] = definedTargets;
+                }
+            }
+
             /* Remember the targets of the first rule defined in the file. */
             if (firstTargets.empty()) {
                 firstTargets = definedTargets;
@@ -182,71 +522,176 @@ MakefileParser::MakefileParser(std::string makefilePath)
     makefile.close();
 }
 
+/**
+ * @brief Assigns the variable of an assignment line, e.g. `VAR := value`, in
+ * the given scope. Error messages name the given makefile.
+ *
+ */
+void MakefileParser::assignVariable(Variables& scope,
+                                    const std::string& assignment,
+                                    size_t lineno,
+                                    const std::string& makefilePath) {
+    /* The characters before `=` select the assignment operator: `:=` or `::=`
+     * expands the value once now, `?=` only assigns an undefined variable and
+     * `+=` appends to the current value. */
+    size_t equalPos = assignment.find('=');
+    assert(equalPos != std::string::npos);
+    std::string varName = assignment.substr(0, equalPos);
+    char assignOp = '=';
+    if (varName.ends_with("::")) {
+        assignOp = ':';
+        varName.resize(varName.size() - 2);
+    } else if (varName.ends_with(':') || varName.ends_with('?') ||
+               varName.ends_with('+')) {
+        assignOp = varName.back();
+        varName.pop_back();
+    }
+
+    /* Expand variables in the variable's name. */
+    try {
+        varName = scope.expandVariables(varName, lineno);
+    } catch (const Variables::VariablesException& e) {
+        throw MakefileParserException("%s:%s", makefilePath.c_str(), e.what());
+    }
+    varName = StringOps::trim(varName);
+
+    /* Error on an empty variable name. */
+    if (varName.empty()) {
+        throw MakefileParserException("%s:%d: *** empty variable name.  Stop.",
+                                      makefilePath.c_str(), lineno);
+    }
+
+    /* Assign value to the variable name. */
+    std::string varValue = StringOps::trim(assignment.substr(equalPos + 1));
+    try {
+        if (assignOp == ':') {
+            scope.addVariable(varName, scope.expandVariables(varValue, lineno),
+                              lineno, Variables::Flavor::Simple);
+        } else if (assignOp == '+') {
+            scope.appendVariable(varName, varValue, lineno);
+        } else if (assignOp != '?' || !scope.defined(varName)) {
+            scope.addVariable(varName, varValue, lineno);
+        }
+    } catch (const Variables::VariablesException& e) {
+        throw MakefileParserException("%s:%s", makefilePath.c_str(), e.what());
+    }
+}
+
 /**
  * @brief Returns a target's recipes and recipe line numbers, expanding any
- * recipe variables first, including automatic variables. If no target exists,
+ * recipe variables first, including automatic variables and the target's own
+ * variables. If no target exists,
  * nothing is returned. Throws an error if variable expansion fails.
  *
  */
 std::tuple<std::vector<std::string>, std::vector<size_t>>
 MakefileParser::getRecipes(const std::string& target) {
-    /* Lookup target. */
-    if (!makefileRecipes.contains(target)) {
+    resolvePatternRule(target);
+    auto savedRecipes = makefileRecipes.find(target);
+    if (savedRecipes == makefileRecipes.end()) {
         return {};
     }
-    std::vector<std::string> savedRecipes = makefileRecipes[target];
-    std::vector<size_t> recipeLinenos = makefileRecipeLinenos[target];
-
-    /* Create automatic variables. */
-    Variables autovars = makefileVars;
-    autovars.addVariable("@", target, 0);
-    std::vector<std::string> prereqs = makefilePrereqs[target];
-    if (!prereqs.empty()) {
-        autovars.addVariable("<", prereqs.front(), 0);
-        autovars.addVariable(
-            "^",
-            std::accumulate(std::next(prereqs.begin()), prereqs.end(),
-                            prereqs[0],
-                            [](const std::string& a, const std::string& b) {
-                                return a + " " + b;
-                            }),
-            0);
+    const std::vector<size_t>& recipeLinenos =
+        makefileRecipeLinenos.at(target);
+
+    /* Create automatic variables. They are looked up before the makefile's
+     * variables, which are shared rather than copied. */
+    std::map<std::string, std::string> autovars = {{"@", target}};
+    auto prereqs = makefilePrereqs.find(target);
+    if (prereqs != makefilePrereqs.end() && !prereqs->second.empty()) {
+        autovars["<"] = prereqs->second.front();
+        autovars["^"] = StringOps::join(prereqs->second, ' ');
+    }
+    auto orderOnly = makefileOrderOnlyPrereqs.find(target);
+    if (orderOnly != makefileOrderOnlyPrereqs.end() &&
+        !orderOnly->second.empty()) {
+        autovars["|"] = StringOps::join(orderOnly->second, ' ');
     }
+    auto stem = makefileStems.find(target);
+    if (stem != makefileStems.end()) {
+        autovars["*"] = stem->second;
+    }
+
+    /* The target's own variables, if it has any, are looked up before the
+     * makefile's. */
+    auto targetScope = targetVariables.find(target);
+    const Variables& scope = targetScope == targetVariables.end()
+                                 ? makefileVars
+                                 : targetScope->second;
 
     /* Expand variables in each recipe. */
     std::vector<std::string> expandedRecipes;
-    for (size_t i = 0; i < savedRecipes.size(); i++) {
-        std::string expandedRecipe;
+    for (size_t i = 0; i < savedRecipes->second.size(); i++) {
         try {
-            expandedRecipe = autovars.expandVariables(savedRecipes.at(i),
-                                                      recipeLinenos.at(i));
+            expandedRecipes.push_back(scope.expandVariables(
+                savedRecipes->second.at(i), recipeLinenos.at(i), autovars));
         } catch (const Variables::VariablesException& e) {
             throw MakefileParserException("%s:%s", makefilePath.c_str(),
                                           e.what());
         }
-        expandedRecipes.push_back(expandedRecipe);
     }
 
     assert(expandedRecipes.size() == recipeLinenos.size());
     return {expandedRecipes, recipeLinenos};
 }
 
+/**
+ * @brief Returns a target's order-only prerequisites, those after a `|`, for a
+ * target that has already been looked up by `getPrereqs`. They are built
+ * before the target, but their files are never compared with its file.
+ *
+ */
+std::vector<std::string> MakefileParser::getOrderOnlyPrereqs(
+    const std::string& target) const {
+    auto orderOnly = makefileOrderOnlyPrereqs.find(target);
+    if (orderOnly == makefileOrderOnlyPrereqs.end()) {
+        return {};
+    }
+    return orderOnly->second;
+}
+
+/**
+ * @brief Returns true if `.PHONY` names the target, i.e. if it is not a file.
+ *
+ */
+bool MakefileParser::isPhony(const std::string& target) const {
+    return phonyTargets.contains(target);
+}
+
+/**
+ * @brief Returns true if the target has at least one recipe, i.e. if building
+ * it can change any file.
+ *
+ */
+bool MakefileParser::hasRecipes(const std::string& target) {
+    resolvePatternRule(target);
+    return makefileRecipes.contains(target);
+}
+
 /**
  * @brief Return a target's prerequisites. Throw error if the target is not
  * defined, the target depends on itself, or a prerequisite is not defined.
+ * Targets are defined by a rule, by a matching pattern rule, or by being an
+ * existing file.
  *
  */
 std::vector<std::string> MakefileParser::getPrereqs(const std::string& target) {
     /* Throw error if target not defined. */
-    if (!makefilePrereqs.contains(target)) {
+    if (!defined(target)) {
         throw MakefileParserException(
             "make: *** No rule to make target '%s'. Stop.", target.c_str());
     }
 
     /* Throw error if a prereq is not defined. */
-    std::vector<std::string> prereqs = makefilePrereqs[target];
-    for (const std::string& prereq : prereqs) {
-        if (!makefilePrereqs.contains(prereq)) {
+    std::vector<std::string> prereqs = makefilePrereqs.at(target);
+    std::vector<std::string> checked = prereqs;
+    auto orderOnly = makefileOrderOnlyPrereqs.find(target);
+    if (orderOnly != makefileOrderOnlyPrereqs.end()) {
+        checked.insert(checked.end(), orderOnly->second.begin(),
+                       orderOnly->second.end());
+    }
+    for (const std::string& prereq : checked) {
+        if (!defined(prereq)) {
             throw MakefileParserException(
                 "make: *** No rule to make target '%s', needed by '%s'. Stop.",
                 prereq.c_str(), target.c_str());
@@ -263,51 +708,177 @@ std::vector<std::string> MakefileParser::getPrereqs(const std::string& target) {
 }
 
 /**
- * @brief Returns true if the target is outdated by satisfying any of the
- * following criteria:
- * 1. No file corresponds to the target.
- * 2. No file corresponds to a prerequisite of the target.
- * 3. A file corresponding to a prerequisite has been last-modified later than
- *    the target.
- * 4. There's an error getting a file status.
+ * @brief Returns the targets of the group that the target was defined in by a
+ * `&:` rule, in the order they were defined. The first one stands for the
+ * whole group. A target outside of any group is a group of its own.
  *
  */
-bool MakefileParser::outdated(const std::string& target) {
-    /* Lookup target file. */
-    if (!std::filesystem::exists(target)) {
-        return true;
+std::vector<std::string> MakefileParser::getGroup(
+    const std::string& target) const {
+    auto group = groupedTargets.find(target);
+    if (group == groupedTargets.end()) {
+        return {target};
     }
+    return group->second;
+}
 
-    /* Lookup target file's modified time */
-    struct stat targetStat;
-    if (stat(target.c_str(), &targetStat) != 0) {
-        return true;
+/**
+ * @brief Sets the files that changed since the last build, e.g. as listed by
+ * a version control diff, and which thus are the only ones that can make a
+ * target outdated. This trusts that every target was built since its other
+ * prerequisites last changed, and saves looking up the status of every file
+ * the build depends on, so that planning the build costs time in proportion
+ * to the change rather than to the whole tree.
+ *
+ */
+void MakefileParser::setChangedFiles(const std::vector<std::string>& files) {
+    changedFiles.emplace();
+    for (const std::string& file : files) {
+        changedFiles->insert(
+            std::filesystem::path(file).lexically_normal().string());
     }
-    timespec targetModTime = targetStat.st_mtim;
+}
 
-    for (const std::string& prereq : makefilePrereqs[target]) {
-        /* Lookup prereq file. */
-        if (!std::filesystem::exists(prereq)) {
-            return true;
-        }
+/**
+ * @brief Looks up the status of all given files in one batch, so that checking
+ * whether targets are outdated does not have to. If the changed files are
+ * known, finds the targets that depend on them instead.
+ *
+ */
+void MakefileParser::prefetchFileStatus(const std::vector<std::string>& paths) {
+    if (changedFiles) {
+        findChangedDependents();
+        return;
+    }
+    fileStatus.prefetch(paths);
+}
 
-        /* Compare prereq file's last modified time to the target file's. */
-        struct stat prereqStat;
-        if (stat(prereq.c_str(), &prereqStat) != 0) {
-            return true;
+/**
+ * @brief Adds to the index of dependents that the target has the
+ * prerequisite. Nothing is added until the index is first built.
+ *
+ */
+void MakefileParser::indexPrereq(const std::string& target,
+                                 const std::string& prereq) {
+    if (dependentsIndexed) {
+        dependents[std::filesystem::path(prereq).lexically_normal().string()]
+            .push_back(target);
+    }
+}
+
+/**
+ * @brief Finds the targets that depend on a changed file, by walking an index
+ * from each prerequisite to the targets that depend on it. The index is built
+ * from every rule the first time, and then only grows as pattern rules are
+ * matched while making the tasks, so this costs time in proportion to the
+ * dependents found. Paths are compared in normal form, like the changed files.
+ * Order-only prerequisites are left out, since they do not make a target
+ * outdated.
+ *
+ */
+void MakefileParser::findChangedDependents() {
+    if (!dependentsIndexed) {
+        dependentsIndexed = true;
+        for (const auto& [target, prereqs] : makefilePrereqs) {
+            for (const std::string& prereq : prereqs) {
+                indexPrereq(target, prereq);
+            }
         }
-        timespec prereqModTime = prereqStat.st_mtim;
+    }
 
-        bool prereqModifiedLater =
-            (prereqModTime.tv_sec > targetModTime.tv_sec) ||
-            (prereqModTime.tv_sec == targetModTime.tv_sec &&
-             prereqModTime.tv_nsec > targetModTime.tv_nsec);
-        if (prereqModifiedLater) {
-            return true;
+    changedDependents.clear();
+    std::vector<std::string> stack(changedFiles->begin(), changedFiles->end());
+    while (!stack.empty()) {
+        std::string current = stack.back();
+        stack.pop_back();
+        auto found = dependents.find(
+            std::filesystem::path(current).lexically_normal().string());
+        if (found == dependents.end()) {
+            continue;
+        }
+        for (const std::string& dependent : found->second) {
+            if (changedDependents.insert(dependent).second) {
+                stack.push_back(dependent);
+            }
         }
     }
+}
 
-    return false;
+/**
+ * @brief Looks up the status of a file again, e.g. because a recipe may have
+ * just written it.
+ *
+ */
+void MakefileParser::refreshFileStatus(const std::string& path) {
+    fileStatus.refresh(path);
+}
+
+/**
+ * @brief Forgets the results of the wildcard and shell functions, so that
+ * recipes expanded in the next build see the files and command output as
+ * they are then.
+ *
+ */
+void MakefileParser::clearFunctionCache() {
+    makefileVars.clearFunctionCache();
+}
+
+/**
+ * @brief Freezes what is known about the given targets, which should all have
+ * been looked up, into a snapshot that any number of threads can query at
+ * once. The snapshot keeps the parser alive, since it shares the parser's
+ * variables, so the parser must be owned by a `std::shared_ptr`, or this
+ * throws `std::bad_weak_ptr`.
+ *
+ */
+std::shared_ptr<const MakefileSnapshot> MakefileParser::snapshot(
+    const std::vector<std::string>& targets) const {
+    return std::make_shared<const MakefileSnapshot>(shared_from_this(),
+                                                    targets);
+}
+
+/**
+ * @brief Writes the restat log if any `.RESTAT` target was recorded in or
+ * removed from it.
+ *
+ */
+void MakefileParser::saveRestatLog() {
+    if (!restatTargets.empty()) {
+        restatLog.save(resolve(RESTAT_LOG_PATH));
+    }
+}
+
+/**
+ * @brief Returns the directory paths in the makefile are relative to. Empty
+ * for the working directory.
+ *
+ */
+const std::string& MakefileParser::getDirectory() const {
+    return directory;
+}
+
+/**
+ * @brief Returns the path of the running MiniMake executable, which `$(MAKE)`
+ * expands to so that recipes can run MiniMake recursively.
+ *
+ */
+const std::string& MakefileParser::makeCommand() {
+    static const std::string command = [] {
+        std::error_code error;
+        std::string path =
+            std::filesystem::read_symlink("/proc/self/exe", error).string();
+        return error ? std::string("make") : path;
+    }();
+    return command;
+}
+
+/**
+ * @brief Returns the path at which a path in the makefile is found from the
+ * working directory.
+ *
+ */
+std::string MakefileParser::resolve(const std::string& path) const {
+    return (std::filesystem::path(directory) / path).string();
 }
 
 /**
@@ -318,33 +889,284 @@ std::vector<std::string> MakefileParser::getFirstTargets() {
     return firstTargets;
 }
 
+/**
+ * @brief Returns the pool the target is assigned to, or an empty string if it
+ * is not in a pool.
+ *
+ */
+std::string MakefileParser::getPool(const std::string& target) {
+    auto found = targetPools.find(target);
+    return found == targetPools.end() ? "" : found->second;
+}
+
+/**
+ * @brief Returns the depth of each declared pool.
+ *
+ */
+std::map<std::string, size_t> MakefileParser::getPoolDepths() {
+    return poolDepths;
+}
+
 /**
  * @brief Returns true if the target or any of its dependencies depends on
- * itself.
+ * itself. Searches depth first, looking up pattern rules on the way, and
+ * remembers the targets found to be acyclic, so each target is only searched
+ * once no matter how many targets depend on it.
  *
  */
 bool MakefileParser::hasCircularDependency(const std::string& target) {
-    std::set<std::string> visitedTargets;
-    std::queue<std::string> queue;
+    if (acyclicTargets.contains(target)) {
+        return false;
+    }
+
+    /* The path from the target to the current target, with the index of the
+     * next prerequisite to visit for each. */
+    std::vector<std::pair<std::string, size_t>> path = {{target, 0}};
+    std::set<std::string> onPath = {target};
+    resolvePatternRule(target);
+
+    while (!path.empty()) {
+        std::string currentTarget = path.back().first;
+        size_t next = path.back().second++;
+
+        /* Order-only prerequisites are visited after the others. */
+        auto prereqs = makefilePrereqs.find(currentTarget);
+        auto orderOnly = makefileOrderOnlyPrereqs.find(currentTarget);
+        size_t numPrereqs =
+            prereqs == makefilePrereqs.end() ? 0 : prereqs->second.size();
+        size_t numOrderOnly = orderOnly == makefileOrderOnlyPrereqs.end()
+                                  ? 0
+                                  : orderOnly->second.size();
+        if (next >= numPrereqs + numOrderOnly) {
+            /* Every dependency of this target has been searched. */
+            acyclicTargets.insert(currentTarget);
+            onPath.erase(currentTarget);
+            path.pop_back();
+            continue;
+        }
+
+        std::string prereq = next < numPrereqs
+                                 ? prereqs->second[next]
+                                 : orderOnly->second[next - numPrereqs];
+        if (onPath.contains(prereq)) {
+            return true;
+        }
+        if (acyclicTargets.contains(prereq)) {
+            continue;
+        }
+        resolvePatternRule(prereq);
+        onPath.insert(prereq);
+        path.emplace_back(prereq, 0);
+    }
+
+    return false;
+}
+
+/**
+ * @brief Adds a pattern rule for the target pattern, which contains a `%`, and
+ * indexes it by the text around the `%`.
+ *
+ */
+void MakefileParser::addPatternRule(
+    const std::string& targetPattern,
+    const std::vector<std::string>& prereqPatterns,
+    const std::vector<std::string>& orderOnlyPatterns) {
+    size_t percentPos = targetPattern.find('%');
+    assert(percentPos != std::string::npos);
+    PatternRule rule{.targetPrefix = targetPattern.substr(0, percentPos),
+                     .targetSuffix = targetPattern.substr(percentPos + 1),
+                     .prereqPatterns = prereqPatterns,
+                     .orderOnlyPatterns = orderOnlyPatterns};
 
-    queue.push(target);
+    PatternRuleBucket& bucket = patternRuleIndex[rule.targetSuffix];
+    bucket.prefixLengths.insert(rule.targetPrefix.size());
+    bucket.rulesByPrefix[rule.targetPrefix].push_back(patternRules.size());
+    patternSuffixLengths.insert(rule.targetSuffix.size());
+    patternRules.push_back(rule);
+}
 
-    while (!queue.empty()) {
-        std::string currentTarget = queue.front();
-        queue.pop();
-        visitedTargets.insert(currentTarget);
+/**
+ * @brief Returns the pattern rule that builds the target and the stem that the
+ * target matches it with. A rule only applies if each of its prerequisites is a
+ * defined target, an existing file, or can itself be built by a pattern rule.
+ * Of the applicable rules, the one with the shortest stem wins, then the one
+ * defined first. Returns nothing if no rule applies.
+ *
+ */
+std::optional<std::tuple<size_t, std::string>> MakefileParser::matchPatternRule(
+    const std::string& target, size_t depth) {
+    if (depth >= MAX_PATTERN_CHAIN) {
+        return std::nullopt;
+    }
 
-        for (const std::string& visitor : makefilePrereqs[currentTarget]) {
-            /* If this prereq was already visited, it is a circular dependency.
-             */
-            if (visitedTargets.contains(visitor)) {
-                return true;
+    /* Find the rules whose prefix and suffix surround a non-empty stem. Both
+     * length sets are sorted, so stop at the first length that is too long.
+     * Each candidate is its stem length, rule and stem. */
+    std::vector<std::tuple<size_t, size_t, std::string>> candidates;
+    for (size_t suffixLength : patternSuffixLengths) {
+        if (suffixLength >= target.size()) {
+            break;
+        }
+        auto bucket =
+            patternRuleIndex.find(target.substr(target.size() - suffixLength));
+        if (bucket == patternRuleIndex.end()) {
+            continue;
+        }
+        for (size_t prefixLength : bucket->second.prefixLengths) {
+            if (prefixLength + suffixLength >= target.size()) {
+                break;
             }
+            auto rules = bucket->second.rulesByPrefix.find(
+                target.substr(0, prefixLength));
+            if (rules == bucket->second.rulesByPrefix.end()) {
+                continue;
+            }
+            std::string stem = target.substr(
+                prefixLength, target.size() - prefixLength - suffixLength);
+            for (size_t rule : rules->second) {
+                candidates.emplace_back(stem.size(), rule, stem);
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto& [stemLength, rule, stem] : candidates) {
+        bool applies = std::all_of(
+            patternRules[rule].prereqPatterns.begin(),
+            patternRules[rule].prereqPatterns.end(),
+            [&](const std::string& prereqPattern) {
+                std::string prereq = substituteStem(prereqPattern, stem);
+                return makefilePrereqs.contains(prereq) ||
+                       fileStatus.modifiedTime(prereq).has_value() ||
+                       matchPatternRule(prereq, depth + 1).has_value();
+            });
+        if (applies) {
+            return std::make_tuple(rule, stem);
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Gives a target without recipes the prerequisites and recipes of the
+ * pattern rule that builds it, if any. The pattern rule's prerequisites come
+ * first, followed by those the target was explicitly given. Each target is only
+ * looked up once.
+ *
+ */
+void MakefileParser::resolvePatternRule(const std::string& target) {
+    if (patternRules.empty() || !resolvedTargets.insert(target).second ||
+        makefileRecipes.contains(target)) {
+        return;
+    }
 
-            /* Visit this target's prereqs next. */
-            queue.push(visitor);
+    std::optional<std::tuple<size_t, std::string>> match =
+        matchPatternRule(target, 0);
+    if (!match) {
+        return;
+    }
+    const auto& [ruleIndex, stem] = *match;
+    const PatternRule& rule = patternRules[ruleIndex];
+
+    std::vector<std::string> prereqs;
+    for (const std::string& prereqPattern : rule.prereqPatterns) {
+        prereqs.push_back(substituteStem(prereqPattern, stem));
+        indexPrereq(target, prereqs.back());
+    }
+    if (makefilePrereqs.contains(target)) {
+        for (const std::string& prereq : makefilePrereqs[target]) {
+            if (std::find(prereqs.begin(), prereqs.end(), prereq) ==
+                prereqs.end()) {
+                prereqs.push_back(prereq);
+            }
         }
     }
 
+    makefilePrereqs[target] = prereqs;
+    for (const std::string& orderOnlyPattern : rule.orderOnlyPatterns) {
+        makefileOrderOnlyPrereqs[target].push_back(
+            substituteStem(orderOnlyPattern, stem));
+    }
+    if (!rule.recipes.empty()) {
+        makefileRecipes[target] = rule.recipes;
+        makefileRecipeLinenos[target] = rule.recipeLinenos;
+    }
+    makefileStems[target] = stem;
+}
+
+/**
+ * @brief Returns true if the makefile says how to build the target, either
+ * through a rule or a pattern rule, or if the target is an existing file that
+ * needs no rule. Existing files are remembered as targets without
+ * prerequisites.
+ *
+ */
+bool MakefileParser::defined(const std::string& target) {
+    resolvePatternRule(target);
+    if (makefilePrereqs.contains(target)) {
+        return true;
+    }
+    if (fileStatus.modifiedTime(target).has_value()) {
+        makefilePrereqs[target] = {};
+        return true;
+    }
     return false;
 }
+
+/**
+ * @brief Adds the rules of a dependency file, like those that `gcc -MMD`
+ * writes, without going through the general parser. The file is memory mapped
+ * and scanned once, and its prerequisites are merged straight into the
+ * targets' prerequisites. Returns false and adds nothing if the file is not
+ * purely made of rules without recipes or variables, in which case it should be
+ * parsed as a general makefile.
+ *
+ */
+bool MakefileParser::parseDepfile(const std::string& depfilePath) {
+    int fd = open(resolve(depfilePath).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat depfileStat;
+    if (fstat(fd, &depfileStat) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = depfileStat.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    DepfileRules rules;
+    bool isDepfile =
+        scanDepfile(static_cast<const char*>(mapping), size, rules);
+    munmap(mapping, size);
+    if (!isDepfile) {
+        return false;
+    }
+
+    for (const auto& [targets, prereqs] : rules) {
+        for (const std::string& target : targets) {
+            std::vector<std::string>& targetPrereqs = makefilePrereqs[target];
+            targetPrereqs.insert(targetPrereqs.end(), prereqs.begin(),
+                                 prereqs.end());
+
+            /* Do not duplicate any prereqs. */
+            std::sort(targetPrereqs.begin(), targetPrereqs.end());
+            targetPrereqs.erase(
+                std::unique(targetPrereqs.begin(), targetPrereqs.end()),
+                targetPrereqs.end());
+        }
+        if (firstTargets.empty()) {
+            firstTargets = targets;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,321 @@
+#include "makefile-snapshot.h"
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <utility>
+
+#include "makefile-parser.h"
+#include "string-ops.h"
+
+namespace {
+
+/**
+ * @brief Returns true if the first time is later than the second.
+ *
+ */
+bool laterThan(const timespec& first, const timespec& second) {
+    return first.tv_sec > second.tv_sec ||
+           (first.tv_sec == second.tv_sec && first.tv_nsec > second.tv_nsec);
+}
+
+}  // namespace
+
+/**
+ * @brief Copies what the parser knows about the given targets, which should
+ * all have been looked up already, e.g. by `getPrereqs`, so that their pattern
+ * rules are resolved. Other targets are treated as files without rules.
+ * Dependents of changed files are those found by the last
+ * `prefetchFileStatus`. The parser is kept alive, since recipes are expanded
+ * with its variables and files are looked up through its statuses.
+ *
+ */
+MakefileSnapshot::MakefileSnapshot(
+    std::shared_ptr<const MakefileParser> owner,
+    const std::vector<std::string>& targets)
+    : owner(std::move(owner)),
+      makefilePath(this->owner->makefilePath),
+      directory(this->owner->directory),
+      changedFilesKnown(this->owner->changedFiles.has_value()),
+      fileStatus(&this->owner->fileStatus),
+      restatLog(&this->owner->restatLog) {
+    const MakefileParser& parser = *this->owner;
+    std::vector<std::string> names = targets;
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    entries.reserve(names.size());
+    for (const std::string& name : names) {
+        Entry entry{.target = name,
+                    .group = parser.getGroup(name),
+                    .scope = &parser.makefileVars,
+                    .phony = parser.phonyTargets.contains(name),
+                    .restat = parser.restatTargets.contains(name),
+                    .changedDependent =
+                        parser.changedDependents.contains(name)};
+        auto prereqs = parser.makefilePrereqs.find(name);
+        if (prereqs != parser.makefilePrereqs.end()) {
+            entry.prereqs = prereqs->second;
+        }
+        auto orderOnly = parser.makefileOrderOnlyPrereqs.find(name);
+        if (orderOnly != parser.makefileOrderOnlyPrereqs.end()) {
+            entry.orderOnlyPrereqs = orderOnly->second;
+        }
+        auto recipes = parser.makefileRecipes.find(name);
+        if (recipes != parser.makefileRecipes.end()) {
+            entry.recipes = recipes->second;
+            entry.recipeLinenos = parser.makefileRecipeLinenos.at(name);
+        }
+        auto stem = parser.makefileStems.find(name);
+        if (stem != parser.makefileStems.end()) {
+            entry.stem = stem->second;
+        }
+        auto targetScope = parser.targetVariables.find(name);
+        if (targetScope != parser.targetVariables.end()) {
+            entry.scope = &targetScope->second;
+        }
+        entries.push_back(std::move(entry));
+    }
+}
+
+/**
+ * @brief Returns the entry of a target, or nullptr if it is not in the
+ * snapshot.
+ *
+ */
+const MakefileSnapshot::Entry* MakefileSnapshot::find(
+    const std::string& target) const {
+    auto found = std::lower_bound(
+        entries.begin(), entries.end(), target,
+        [](const Entry& entry, const std::string& name) {
+            return entry.target < name;
+        });
+    if (found == entries.end() || found->target != target) {
+        return nullptr;
+    }
+    return &*found;
+}
+
+/**
+ * @brief Returns a target's recipes and recipe line numbers, with variables
+ * expanded, including automatic variables and the target's own variables.
+ * Nothing is returned for a target without recipes. Throws an error if
+ * variable expansion fails.
+ *
+ */
+std::tuple<std::vector<std::string>, std::vector<size_t>>
+MakefileSnapshot::expandRecipes(const std::string& target) const {
+    const Entry* entry = find(target);
+    if (!entry || entry->recipes.empty()) {
+        return {};
+    }
+
+    /* Create automatic variables. They are looked up before the makefile's
+     * variables, which are shared rather than copied. */
+    std::map<std::string, std::string> autovars = {{"@", target}};
+    if (!entry->prereqs.empty()) {
+        autovars["<"] = entry->prereqs.front();
+        autovars["^"] = StringOps::join(entry->prereqs, ' ');
+    }
+    if (!entry->orderOnlyPrereqs.empty()) {
+        autovars["|"] = StringOps::join(entry->orderOnlyPrereqs, ' ');
+    }
+    if (entry->stem) {
+        autovars["*"] = *entry->stem;
+    }
+
+    /* Expand variables in each recipe. */
+    std::vector<std::string> expandedRecipes;
+    for (size_t i = 0; i < entry->recipes.size(); i++) {
+        try {
+            expandedRecipes.push_back(entry->scope->expandVariables(
+                entry->recipes[i], entry->recipeLinenos.at(i), autovars));
+        } catch (const Variables::VariablesException& e) {
+            throw MakefileParser::MakefileParserException(
+                "%s:%s", makefilePath.c_str(), e.what());
+        }
+    }
+
+    assert(expandedRecipes.size() == entry->recipeLinenos.size());
+    return {expandedRecipes, entry->recipeLinenos};
+}
+
+/**
+ * @brief Returns a target's prerequisites, not counting order-only ones.
+ *
+ */
+const std::vector<std::string>& MakefileSnapshot::getPrereqs(
+    const std::string& target) const {
+    static const std::vector<std::string> none;
+    const Entry* entry = find(target);
+    return entry ? entry->prereqs : none;
+}
+
+/**
+ * @brief Returns the targets of the group that the target was defined in by a
+ * `&:` rule, see `MakefileParser::getGroup`.
+ *
+ */
+std::vector<std::string> MakefileSnapshot::getGroup(
+    const std::string& target) const {
+    const Entry* entry = find(target);
+    return entry ? entry->group : std::vector<std::string>{target};
+}
+
+/**
+ * @brief Returns true if `.PHONY` names the target, i.e. if it is not a file.
+ *
+ */
+bool MakefileSnapshot::isPhony(const std::string& target) const {
+    const Entry* entry = find(target);
+    return entry && entry->phony;
+}
+
+/**
+ * @brief Returns true if the target, or any other target of its group, is
+ * outdated, since one run of the recipes builds them all.
+ *
+ */
+bool MakefileSnapshot::outdated(const std::string& target) const {
+    std::vector<std::string> group = getGroup(target);
+    return std::any_of(group.begin(), group.end(),
+                       [this](const std::string& member) {
+                           return outdatedFile(member);
+                       });
+}
+
+/**
+ * @brief Returns true if the target is outdated by satisfying any of the
+ * following criteria:
+ * 1. No file corresponds to the target.
+ * 2. No file corresponds to a prerequisite of the target.
+ * 3. A file corresponding to a prerequisite has been last-modified later than
+ *    the target.
+ * 4. There's an error getting a file status.
+ * 5. The target or a prerequisite is phony.
+ *
+ * Order-only prerequisites are not compared. Phony targets are never looked
+ * up. File statuses are remembered, so a file is only looked up again once it
+ * is refreshed. A `.RESTAT` target whose recipe last ran without modifying it
+ * is compared as if it was modified when that run's newest prerequisite was.
+ *
+ * If the changed files are known, nothing is looked up, and only the targets
+ * that depend on them are outdated, see `MakefileParser::setChangedFiles`.
+ *
+ */
+bool MakefileSnapshot::outdatedFile(const std::string& target) const {
+    const Entry* entry = find(target);
+    if (entry && entry->phony) {
+        return true;
+    }
+    if (changedFilesKnown) {
+        return entry && entry->changedDependent;
+    }
+
+    /* Lookup target file's modified time. */
+    std::optional<timespec> targetModTime = fileStatus->modifiedTime(target);
+    if (!targetModTime) {
+        return true;
+    }
+    if (!entry) {
+        return false;
+    }
+    if (entry->restat) {
+        std::optional<timespec> builtAsOf = restatLog->builtAsOf(target);
+        if (builtAsOf && laterThan(*builtAsOf, *targetModTime)) {
+            targetModTime = builtAsOf;
+        }
+    }
+
+    for (const std::string& prereq : entry->prereqs) {
+        if (isPhony(prereq)) {
+            return true;
+        }
+
+        /* Lookup prereq file's modified time. */
+        std::optional<timespec> prereqModTime =
+            fileStatus->modifiedTime(prereq);
+        if (!prereqModTime) {
+            return true;
+        }
+
+        /* Compare prereq file's last modified time to the target file's. */
+        if (laterThan(*prereqModTime, *targetModTime)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Looks up the status of a file again, e.g. because a recipe may have
+ * just written it.
+ *
+ */
+void MakefileSnapshot::refreshFileStatus(const std::string& path) const {
+    fileStatus->refresh(path);
+}
+
+/**
+ * @brief Returns the remembered last-modified time of a file, or nothing if it
+ * does not exist or is phony.
+ *
+ */
+std::optional<timespec> MakefileSnapshot::modifiedTime(
+    const std::string& path) const {
+    if (isPhony(path)) {
+        return std::nullopt;
+    }
+    return fileStatus->modifiedTime(path);
+}
+
+/**
+ * @brief Looks up the status of a target again after its recipes ran. A
+ * `.RESTAT` target whose file was not modified by them is recorded in the
+ * restat log as built as of its newest prerequisite, so it is up to date in
+ * later builds too. Its dependents compare against the unmodified file, so
+ * they are not rebuilt on its account.
+ *
+ * @param modifiedBefore The target's last-modified time before the recipes ran.
+ *
+ */
+void MakefileSnapshot::restat(const std::string& target,
+                              std::optional<timespec> modifiedBefore) const {
+    const Entry* entry = find(target);
+    if (entry && entry->phony) {
+        return;
+    }
+    fileStatus->refresh(target);
+    if (!entry || !entry->restat) {
+        return;
+    }
+
+    std::optional<timespec> modifiedAfter = fileStatus->modifiedTime(target);
+    bool unmodified = modifiedBefore && modifiedAfter &&
+                      !laterThan(*modifiedAfter, *modifiedBefore) &&
+                      !laterThan(*modifiedBefore, *modifiedAfter);
+    if (!unmodified) {
+        restatLog->erase(target);
+        return;
+    }
+
+    timespec newest = *modifiedAfter;
+    for (const std::string& prereq : entry->prereqs) {
+        std::optional<timespec> prereqModTime =
+            fileStatus->modifiedTime(prereq);
+        if (prereqModTime && laterThan(*prereqModTime, newest)) {
+            newest = *prereqModTime;
+        }
+    }
+    restatLog->record(target, newest);
+}
+
+/**
+ * @brief Returns the directory paths in the makefile are relative to. Empty
+ * for the working directory.
+ *
+ */
+const std::string& MakefileSnapshot::getDirectory() const {
+    return directory;
+}
\ No newline at end of file
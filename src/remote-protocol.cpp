@@ -0,0 +1,191 @@
+#include "remote-protocol.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+
+namespace RemoteProtocol {
+
+namespace {
+
+/* Largest payload accepted from the other side. */
+constexpr uint32_t MAX_PAYLOAD = 64 << 20;
+
+/* Number of connections the worker lets wait to be accepted. */
+constexpr int LISTEN_BACKLOG = 64;
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool readAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t got = read(fd, data, size);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+/**
+ * @brief Creates a socket for the address and calls `setup` on it, e.g. to
+ * connect or bind it. Tries each resolved TCP address in turn. Returns the
+ * socket, or -1 if the address is malformed or `setup` failed for all of them.
+ *
+ */
+int openSocket(const std::string& address,
+               const std::function<bool(int, const sockaddr*, socklen_t)>&
+                   setup) {
+    if (address.starts_with("unix:")) {
+        std::string path = address.substr(5);
+        sockaddr_un unixAddress{.sun_family = AF_UNIX, .sun_path = {}};
+        if (path.empty() || path.size() >= sizeof(unixAddress.sun_path)) {
+            errno = EINVAL;
+            return -1;
+        }
+        std::strcpy(unixAddress.sun_path, path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 &&
+            !setup(fd, reinterpret_cast<const sockaddr*>(&unixAddress),
+                   sizeof(unixAddress))) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        errno = EINVAL;
+        return -1;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* results;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints,
+                    &results) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo* result = results; result && fd == -1;
+         result = result->ai_next) {
+        fd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC,
+                    result->ai_protocol);
+        if (fd != -1 && !setup(fd, result->ai_addr, result->ai_addrlen)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    return fd;
+}
+
+}  // namespace
+
+/**
+ * @brief Sends one frame. Returns false if the connection is broken.
+ *
+ */
+bool sendFrame(int fd, Frame type, const std::string& payload) {
+    char header[5];
+    header[0] = static_cast<char>(type);
+    uint32_t length = htonl(payload.size());
+    std::memcpy(header + 1, &length, sizeof(length));
+    return writeAll(fd, header, sizeof(header)) &&
+           writeAll(fd, payload.data(), payload.size());
+}
+
+/**
+ * @brief Blocks until a whole frame arrives. Returns false if the connection is
+ * closed or broken, or the frame is too large.
+ *
+ */
+bool receiveFrame(int fd, Frame& type, std::string& payload) {
+    char header[5];
+    if (!readAll(fd, header, sizeof(header))) {
+        return false;
+    }
+    uint32_t length;
+    std::memcpy(&length, header + 1, sizeof(length));
+    length = ntohl(length);
+    if (length > MAX_PAYLOAD) {
+        return false;
+    }
+    type = static_cast<Frame>(header[0]);
+    payload.resize(length);
+    return readAll(fd, payload.data(), length);
+}
+
+/**
+ * @brief Connects to a worker at the address. Returns the connected socket, or
+ * -1 with errno set if connecting failed.
+ *
+ */
+int connectTo(const std::string& address) {
+    return openSocket(address,
+                      [](int fd, const sockaddr* addr, socklen_t addrLength) {
+                          if (connect(fd, addr, addrLength) != 0) {
+                              return false;
+                          }
+                          /* Frames are small and each one is waited on. */
+                          int on = 1;
+                          if (addr->sa_family != AF_UNIX) {
+                              setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on,
+                                         sizeof(on));
+                          }
+                          return true;
+                      });
+}
+
+/**
+ * @brief Listens for connections at the address. A stale Unix socket left by
+ * a previous worker is replaced. Returns the listening socket, or -1 with errno
+ * set if listening failed.
+ *
+ */
+int listenOn(const std::string& address) {
+    if (address.starts_with("unix:")) {
+        unlink(address.substr(5).c_str());
+    }
+    return openSocket(address,
+                      [](int fd, const sockaddr* addr, socklen_t addrLength) {
+                          int on = 1;
+                          setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+                                     sizeof(on));
+                          return bind(fd, addr, addrLength) == 0 &&
+                                 listen(fd, LISTEN_BACKLOG) == 0;
+                      });
+}
+
+}  // namespace RemoteProtocol
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "resource-profile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#include "string-ops.h"
+
+/**
+ * @brief Adds what one recipe of the target took.
+ *
+ */
+void ResourceProfile::add(const std::string& target,
+                          const ResourceUsage& usage) {
+    std::lock_guard lock(mutex);
+    ResourceUsage& total = usages[target];
+    total.wallSeconds += usage.wallSeconds;
+    total.userSeconds += usage.userSeconds;
+    total.systemSeconds += usage.systemSeconds;
+    total.maxRssKilobytes =
+        std::max(total.maxRssKilobytes, usage.maxRssKilobytes);
+    total.voluntarySwitches += usage.voluntarySwitches;
+    total.involuntarySwitches += usage.involuntarySwitches;
+}
+
+/**
+ * @brief Returns what the recipes of each target took so far.
+ *
+ */
+std::map<std::string, ResourceUsage> ResourceProfile::getUsages() {
+    std::lock_guard lock(mutex);
+    return usages;
+}
+
+/**
+ * @brief Writes the given number of targets that took the longest, and of
+ * those that took the most memory, for people to read.
+ *
+ */
+void ResourceProfile::writeTop(std::ostream& out, size_t count) {
+    std::vector<std::pair<std::string, ResourceUsage>> top;
+    for (const auto& usage : getUsages()) {
+        top.push_back(usage);
+    }
+    count = std::min(count, top.size());
+
+    /* Ties go to the target that comes first by name. */
+    std::stable_sort(top.begin(), top.end(), [](const auto& a, const auto& b) {
+        return a.second.wallSeconds > b.second.wallSeconds;
+    });
+    out << "slowest targets:\n";
+    for (size_t i = 0; i < count; i++) {
+        const ResourceUsage& usage = top[i].second;
+        out << "  " << top[i].first << ": " << usage.wallSeconds
+            << "s wall, " << usage.userSeconds << "s user, "
+            << usage.systemSeconds << "s system, "
+            << usage.voluntarySwitches + usage.involuntarySwitches
+            << " context switches\n";
+    }
+
+    std::stable_sort(top.begin(), top.end(), [](const auto& a, const auto& b) {
+        return a.second.maxRssKilobytes > b.second.maxRssKilobytes;
+    });
+    out << "hungriest targets:\n";
+    for (size_t i = 0; i < count; i++) {
+        out << "  " << top[i].first << ": " << top[i].second.maxRssKilobytes
+            << " KB max RSS\n";
+    }
+}
+
+/**
+ * @brief Writes every target as CSV with a header line. The first two columns
+ * are the target and its wall time, so the file can be read back with
+ * `DagAnalysis::readDurations`.
+ *
+ */
+void ResourceProfile::writeCsv(std::ostream& out) {
+    out << "target,wall,user,system,max_rss_kb,voluntary_switches,"
+           "involuntary_switches\n";
+    for (const auto& [target, usage] : getUsages()) {
+        out << StringOps::csvField(target) << ',' << usage.wallSeconds << ','
+            << usage.userSeconds << ',' << usage.systemSeconds << ','
+            << usage.maxRssKilobytes << ',' << usage.voluntarySwitches << ','
+            << usage.involuntarySwitches << '\n';
+    }
+}
+
+/**
+ * @brief Writes every target as a JSON object keyed by target.
+ *
+ */
+void ResourceProfile::writeJson(std::ostream& out) {
+    out << '{';
+    bool first = true;
+    for (const auto& [target, usage] : getUsages()) {
+        out << (first ? "\n" : ",\n") << "  "
+            << StringOps::jsonString(target)
+            << ": {\"wall\": " << usage.wallSeconds
+            << ", \"user\": " << usage.userSeconds
+            << ", \"system\": " << usage.systemSeconds
+            << ", \"maxRssKb\": " << usage.maxRssKilobytes
+            << ", \"voluntarySwitches\": " << usage.voluntarySwitches
+            << ", \"involuntarySwitches\": " << usage.involuntarySwitches
+            << '}';
+        first = false;
+    }
+    out << "\n}\n";
+}
+
+/**
+ * @brief Writes every target to the file at the path, as JSON if its name
+ * ends with `.json` or else as CSV. Returns false after outputting an error
+ * message if the file cannot be written.
+ *
+ */
+bool ResourceProfile::writeFile(const std::string& path) {
+    std::ofstream file(path);
+    if (path.ends_with(".json")) {
+        writeJson(file);
+    } else {
+        writeCsv(file);
+    }
+    if (!file) {
+        perror(("write failed for " + path).c_str());
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "restat-log.h"
+
+#include <stdio.h>
+
+#include <fstream>
+
+/**
+ * @brief Adds the targets recorded in the log file at the path. A missing
+ * file is an empty log, and malformed lines are skipped.
+ *
+ */
+void RestatLog::load(const std::string& path) {
+    std::ifstream file(path);
+    std::lock_guard lock(mutex);
+    timespec time;
+    std::string target;
+    while (file >> time.tv_sec >> time.tv_nsec && file.get() == ' ' &&
+           std::getline(file, target)) {
+        times[target] = time;
+    }
+}
+
+/**
+ * @brief Writes the log to the file at the path if it changed, one
+ * `seconds nanoseconds target` line per target. The file is replaced at once,
+ * so an interrupted build never leaves a partial log.
+ *
+ */
+void RestatLog::save(const std::string& path) {
+    std::lock_guard lock(mutex);
+    if (!changed) {
+        return;
+    }
+
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::trunc);
+        for (const auto& [target, time] : times) {
+            file << time.tv_sec << ' ' << time.tv_nsec << ' ' << target << '\n';
+        }
+        if (!file) {
+            perror(("write failed for " + tempPath).c_str());
+            return;
+        }
+    }
+    if (rename(tempPath.c_str(), path.c_str()) != 0) {
+        perror(("rename failed for " + tempPath).c_str());
+        return;
+    }
+    changed = false;
+}
+
+/**
+ * @brief Returns the time the target counts as built as of, or nothing if it
+ * is not recorded.
+ *
+ */
+std::optional<timespec> RestatLog::builtAsOf(const std::string& target) {
+    std::lock_guard lock(mutex);
+    auto found = times.find(target);
+    if (found == times.end()) {
+        return std::nullopt;
+    }
+    return found->second;
+}
+
+/**
+ * @brief Records that the target counts as built as of the given time.
+ *
+ */
+void RestatLog::record(const std::string& target, timespec time) {
+    std::lock_guard lock(mutex);
+    times[target] = time;
+    changed = true;
+}
+
+/**
+ * @brief Forgets the target, e.g. because its recipe modified it.
+ *
+ */
+void RestatLog::erase(const std::string& target) {
+    std::lock_guard lock(mutex);
+    changed |= times.erase(target) > 0;
+}
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "string-ops.h"
 
+#include <cstdio>
 #include <sstream>
 
 namespace StringOps {
@@ -31,4 +32,66 @@ std::vector<std::string> split(const std::string& str, char delimiter) {
     }
     return result;
 }
+
+/**
+ * @brief Joins the strings with the delimiter in between. Takes time linear in
+ * the total length of the strings.
+ *
+ */
+std::string join(const std::vector<std::string>& strs, char delimiter) {
+    size_t size = strs.size();
+    for (const std::string& str : strs) {
+        size += str.size();
+    }
+
+    std::string result;
+    result.reserve(size);
+    for (const std::string& str : strs) {
+        if (&str != &strs.front()) {
+            result += delimiter;
+        }
+        result += str;
+    }
+    return result;
+}
+
+/**
+ * @brief Returns the string as a JSON string literal.
+ *
+ */
+std::string jsonString(const std::string& str) {
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[7];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            result += escaped;
+        } else {
+            result += c;
+        }
+    }
+    return result + '"';
+}
+
+/**
+ * @brief Returns the string as a CSV field. A string with a comma, quote or
+ * line break is quoted, with each quote doubled.
+ *
+ */
+std::string csvField(const std::string& str) {
+    if (str.find_first_of(",\"\r\n") == std::string::npos) {
+        return str;
+    }
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"') {
+            result += '"';
+        }
+        result += c;
+    }
+    return result + '"';
+}
 }  // namespace StringOps
\ No newline at end of file
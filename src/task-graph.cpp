@@ -1,39 +1,110 @@
 #include "task-graph.h"
 
 #include <atomic>
+#include <chrono>
 #include <deque>
 #include <future>
 #include <map>
-#include <semaphore>
+#include <mutex>
+#include <queue>
 #include <set>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 
 namespace TaskGraph {
 
+namespace {
+
+/**
+ * @brief Picks the pool to launch the next ready task from, going round the
+ * pools from `cursor`: the first one that has a ready task and is not full.
+ * Each launch thus costs one step per pool, however many tasks wait.
+ *
+ * @param ready The ready tasks of each pool.
+ * @param numRunningInPool The number of running tasks in each pool.
+ * @param depths The max number of running tasks in each pool.
+ * @param cursor The pool after the one launched from last.
+ * @return The pool, or the number of pools if no task can be launched.
+ */
+template <typename Task>
+size_t nextPool(const std::vector<std::deque<Task>>& ready,
+                const std::vector<size_t>& numRunningInPool,
+                const std::vector<size_t>& depths, size_t cursor) {
+    for (size_t i = 0; i < depths.size(); i++) {
+        size_t pool = (cursor + i) % depths.size();
+        if (!ready[pool].empty() && numRunningInPool[pool] < depths[pool]) {
+            return pool;
+        }
+    }
+    return depths.size();
+}
+
+}  // namespace
+
 /**
  * @brief Runs each task when all its parents have run and returned true. If a
  * task has a parent that is not defined, this parent is ignored. If a task is
  * defined a second time, the second definition is ignored. Independent tasks
- * are run concurrently.
+ * are run concurrently. Each pool keeps its ready tasks in the order they
+ * became ready, and free slots go round the pools that are not full, so a
+ * ready task whose pool is full waits without holding up other ready tasks.
+ * A task with a `runTask` function gets a thread of its
+ * own, while one with a `startTask` function is started on the calling thread
+ * and only reports back when it finishes, so many of these can run with few
+ * threads.
  *
  * @param tasks All tasks in the dependency graph.
  * @param maxThreads Max number of tasks that can be run concurrently.
+ * @param poolDepths Max number of tasks in each pool that can be run
+ * concurrently. Pools that are not listed are unlimited.
+ * @param waits If given, gets how many seconds each task that was launched
+ * waited for a free thread or pool slot after it was ready.
  * @return true Every task ran and returned true.
  * @return false Tasks could not run due to circular dependency, or a task that
  * ran returned false.
  */
-bool run(const std::vector<Task>& tasks, int maxThreads) {
+bool run(const std::vector<Task>& tasks, int maxThreads,
+         const std::map<std::string, size_t>& poolDepths,
+         std::map<std::string, double>* waits) {
     /* SCHEDULE TASKS. */
     /* For each task, this stores the number of parent tasks that still need to
      * be run before it can be run. */
     std::map<std::string, std::atomic<int>> numUntilReady;
 
-    /* Tasks that are ready to run and have not yet been started. */
-    std::deque<std::string> ready;
+    /* Pool 0 holds the tasks without a pool with a depth, and is unlimited. */
+    std::map<std::string, size_t> poolIndices;
+    std::vector<size_t> depths = {SIZE_MAX};
+    for (const auto& [pool, depth] : poolDepths) {
+        poolIndices[pool] = depths.size();
+        depths.push_back(depth);
+    }
+
+    /* Each task's pool. */
+    std::map<std::string, size_t> pools;
+
+    /* The tasks of each pool that are ready to run and have not yet been
+     * started. */
+    std::vector<std::deque<std::string>> ready(depths.size());
+
+    /* When each ready task became ready, if waits are measured. */
+    std::map<std::string, std::chrono::steady_clock::time_point> readySince;
+    auto markReady = [&ready, &pools, &readySince,
+                      waits](const std::string& task) {
+        ready[pools[task]].push_back(task);
+        if (waits) {
+            readySince[task] = std::chrono::steady_clock::now();
+        }
+    };
 
     /* Each task's function that does its work. */
     std::map<std::string, std::function<bool(std::string)>> work;
 
+    /* Each task's function that starts its work, if it runs asynchronously. */
+    std::map<std::string,
+             std::function<void(std::string, std::function<void(bool)>)>>
+        startWork;
+
     /* For each task, the other tasks that it is a parent for. */
     std::map<std::string, std::vector<std::string>> children;
 
@@ -58,104 +129,137 @@ bool run(const std::vector<Task>& tasks, int maxThreads) {
             children[parent].push_back(task.task);
         }
         numUntilReady[task.task] = numRunnableParents;
+        auto pool = poolIndices.find(task.pool);
+        pools[task.task] = pool != poolIndices.end() ? pool->second : 0;
 
         /* Indicate if ready to run. */
         if (numRunnableParents == 0) {
-            ready.push_back(task.task);
+            markReady(task.task);
         }
 
         /* Point to work. */
         work[task.task] = task.runTask;
+        if (task.startTask) {
+            startWork[task.task] = task.startTask;
+        }
     }
 
     /* RUN TASKS. */
-    /* The name and result of each task that is being or has been run but not
-     * yet handled . */
-    std::map<std::string, std::future<bool>> taskFutures;
+    /* Each task that has its own thread, for tasks that run synchronously.
+     * Futures of finished tasks are kept until they are handled. */
+    std::map<std::string, std::future<void>> taskFutures;
 
-    /* True if any task returned failure (i.e. false) in its future. */
+    /* True if any task returned failure (i.e. false). */
     bool taskFailed = false;
 
-    /* The number of threads that have finished and whose results have not been
-     * handled yet. */
+    /* The name and result of each finished task that has not been handled
+     * yet. Tasks finish on other threads, so this is guarded by a mutex. */
+    std::vector<std::pair<std::string, bool>> finished;
+    std::mutex finishedMutex;
+
+    /* The number of tasks in `finished`, which can be waited on. */
     std::atomic<int> threadsFinished = 0;
 
-    /* Acquired when launching each task and released when the task completes.
-     * An acquire blocks until a thread is available to do another task. */
-    std::counting_semaphore taskLimiter(maxThreads);
+    auto finish = [&finished, &finishedMutex, &threadsFinished](
+                      const std::string& taskName, bool success) {
+        /* Notify while holding the lock, since `run` may return, destroying
+         * `threadsFinished`, as soon as the last task is handled. */
+        std::lock_guard lock(finishedMutex);
+        finished.emplace_back(taskName, success);
+        threadsFinished++;
+        threadsFinished.notify_one();
+    };
+
+    /* Blocks until a task finishes, then returns every task that finished. */
+    auto waitForFinished = [&finished, &finishedMutex, &threadsFinished]() {
+        /* The compare and wait is atomic to a notify event, for why see
+         * https://stackoverflow.com/a/65563565. */
+        threadsFinished.wait(0);
+        std::lock_guard lock(finishedMutex);
+        std::vector<std::pair<std::string, bool>> result;
+        result.swap(finished);
+        threadsFinished = 0;
+        return result;
+    };
+
+    /* The number of tasks that have been launched and not yet handled, in
+     * total and for each pool. */
+    int numRunning = 0;
+    std::vector<size_t> numRunningInPool(depths.size());
+    size_t cursor = 0;
 
     while (true) {
-        /* There are tasks ready to run. Launch the next ready task in a new
-         * thread. When no threads are available, block until a thread finishes.
-         */
-        while (!ready.empty()) {
-            taskLimiter.acquire();
-            std::string taskName = ready.front();
-            ready.pop_front();
+        /* Launch ready tasks while threads are available, taking the first
+         * ready task of the next pool that is not full. */
+        while (numRunning < maxThreads) {
+            size_t pool = nextPool(ready, numRunningInPool, depths, cursor);
+            if (pool == depths.size()) {
+                break;
+            }
+            cursor = pool + 1;
+            std::string taskName = ready[pool].front();
+            ready[pool].pop_front();
+            numRunning++;
+            numRunningInPool[pool]++;
+            if (waits) {
+                std::chrono::duration<double> waited =
+                    std::chrono::steady_clock::now() - readySince[taskName];
+                (*waits)[taskName] = waited.count();
+            }
 
-            auto runTask = work[taskName];
+            if (startWork.contains(taskName)) {
+                startWork[taskName](taskName,
+                                    [taskName, &finish](bool success) {
+                                        finish(taskName, success);
+                                    });
+                continue;
+            }
 
+            auto runTask = work[taskName];
             taskFutures[taskName] =
-                std::async(std::launch::async,
-                           [taskName, runTask, &taskLimiter, &threadsFinished] {
-                               bool success = runTask(taskName);
-                               threadsFinished++;
-                               threadsFinished.notify_one();
-                               taskLimiter.release();
-                               return success;
-                           });
+                std::async(std::launch::async, [taskName, runTask, &finish] {
+                    finish(taskName, runTask(taskName));
+                });
         }
 
         /* We can stop if nothing is ready and nothing is running. */
-        if (taskFutures.empty()) {
+        if (numRunning == 0) {
             break;
         }
 
-        /* There are no tasks ready to run. Block until a task finishes. The
-         * compare and wait is atomic to a notify event, for why see
-         * https://stackoverflow.com/a/65563565. */
-        threadsFinished.wait(0);
-
-        /* For each finished task, get its future, queue up its ready children
-         * to run, then remove it. If it failed, stop running tasks. */
-        std::vector<std::string> toRemove;
-        for (auto& [taskName, taskFuture] : taskFutures) {
-            bool finished = taskFuture.wait_for(std::chrono::seconds(0)) ==
-                            std::future_status::ready;
-            if (!finished) {
-                continue;
+        /* No more tasks can be launched. Block until a task finishes. For
+         * each finished task, queue up its ready children to run. If it
+         * failed, stop running tasks. */
+        for (const auto& [taskName, success] : waitForFinished()) {
+            numRunning--;
+            numRunningInPool[pools[taskName]]--;
+            taskFutures.erase(taskName);
+            if (!success) {
+                taskFailed = true;
             }
-
-            threadsFinished--;
-            taskFailed = !taskFuture.get();
-            /* Remove tasks whose futures have already been gotten, or else a
-             * subsequent get will access an invalid future state. */
-            toRemove.push_back(taskName);
             if (taskFailed) {
-                break;
+                continue;
             }
 
             for (const std::string& child : children[taskName]) {
                 numUntilReady[child]--;
                 if (numUntilReady[child] == 0) {
-                    ready.push_back(child);
+                    markReady(child);
                 }
             }
         }
 
-        for (const std::string& taskName : toRemove) {
-            taskFutures.erase(taskName);
-        }
-
         if (taskFailed) {
             break;
         }
     }
 
-    /* Wait for remaining tasks to finish. */
-    for (auto& [taskName, taskFuture] : taskFutures) {
-        taskFuture.wait();
+    /* Wait for remaining tasks to finish, since they report back to this
+     * function. */
+    while (numRunning > 0) {
+        numRunning -= waitForFinished().size();
     }
+    taskFutures.clear();
 
     /* Confirm no task failed. */
     if (taskFailed) {
@@ -172,4 +276,125 @@ bool run(const std::vector<Task>& tasks, int maxThreads) {
     return runnedAll;
 }
 
+/**
+ * @brief Runs the tasks as `run` would, but on a virtual clock instead of
+ * threads, with each task taking the time the given function returns for it
+ * instead of doing its work. Tasks are launched in the same order as by `run`:
+ * whenever a slot is free, the first ready task of the next pool round the
+ * pools that is not full. Tasks finishing at the same time are handled
+ * together, in the order they started. The result only depends on the graph
+ * and the durations, so scheduling can be compared across numbers of jobs
+ * quickly and reproducibly.
+ * Tasks are numbered once up front, so each simulated event costs a heap
+ * operation rather than lookups by name.
+ *
+ * @param tasks All tasks in the dependency graph. Their functions are not
+ * called.
+ * @param maxThreads Number of slots that tasks run in.
+ * @param duration Returns how long the named task runs for. Negative
+ * durations count as 0.
+ * @param poolDepths Max number of tasks in each pool that can run
+ * concurrently. Pools that are not listed are unlimited.
+ */
+Simulation simulate(const std::vector<Task>& tasks, int maxThreads,
+                    const std::function<double(const std::string&)>& duration,
+                    const std::map<std::string, size_t>& poolDepths) {
+    /* Number the tasks, ignoring any second definition. */
+    std::unordered_map<std::string, size_t> indices;
+    std::vector<const Task*> defined;
+    for (const Task& task : tasks) {
+        if (indices.try_emplace(task.task, defined.size()).second) {
+            defined.push_back(&task);
+        }
+    }
+
+    /* Pool 0 holds the tasks without a pool with a depth, and is unlimited. */
+    std::map<std::string, size_t> poolIndices;
+    std::vector<size_t> depths = {SIZE_MAX};
+    for (const auto& [pool, depth] : poolDepths) {
+        poolIndices[pool] = depths.size();
+        depths.push_back(depth);
+    }
+
+    std::vector<size_t> numUntilReady(defined.size());
+    std::vector<std::vector<size_t>> children(defined.size());
+    std::vector<size_t> pools(defined.size());
+    for (size_t i = 0; i < defined.size(); i++) {
+        for (const std::string& parent : defined[i]->parentTasks) {
+            auto parentIndex = indices.find(parent);
+            if (parentIndex != indices.end()) {
+                children[parentIndex->second].push_back(i);
+                numUntilReady[i]++;
+            }
+        }
+        auto pool = poolIndices.find(defined[i]->pool);
+        if (pool != poolIndices.end()) {
+            pools[i] = pool->second;
+        }
+    }
+
+    /* The ready tasks of each pool, in the order they became ready. */
+    std::vector<std::deque<size_t>> ready(depths.size());
+    for (size_t i = 0; i < defined.size(); i++) {
+        if (numUntilReady[i] == 0) {
+            ready[pools[i]].push_back(i);
+        }
+    }
+
+    /* The running tasks by finish time, then start order. */
+    using Event = std::tuple<double, size_t, size_t>;
+    std::priority_queue<Event, std::vector<Event>, std::greater<>> running;
+    std::vector<size_t> numRunningInPool(depths.size());
+    size_t numStarted = 0;
+    size_t cursor = 0;
+
+    Simulation simulation;
+    double now = 0;
+    while (true) {
+        /* Launch the first ready task of the next pool that is not full while
+         * slots are free. */
+        while (running.size() < static_cast<size_t>(std::max(maxThreads, 0))) {
+            size_t pool = nextPool(ready, numRunningInPool, depths, cursor);
+            if (pool == depths.size()) {
+                break;
+            }
+            cursor = pool + 1;
+            size_t task = ready[pool].front();
+            ready[pool].pop_front();
+            numRunningInPool[pool]++;
+            double taskDuration = std::max(duration(defined[task]->task), 0.0);
+            simulation.busyTime += taskDuration;
+            running.emplace(now + taskDuration, numStarted++, task);
+        }
+
+        /* We can stop if nothing is ready and nothing is running. */
+        if (running.empty()) {
+            break;
+        }
+
+        /* Advance the clock to the next finish, and queue up the ready
+         * children of every task that finishes then. */
+        now = std::get<0>(running.top());
+        while (!running.empty() && std::get<0>(running.top()) == now) {
+            size_t task = std::get<2>(running.top());
+            running.pop();
+            numRunningInPool[pools[task]]--;
+            simulation.numTasks++;
+            for (size_t child : children[task]) {
+                if (--numUntilReady[child] == 0) {
+                    ready[pools[child]].push_back(child);
+                }
+            }
+        }
+    }
+
+    simulation.complete = simulation.numTasks == defined.size();
+    simulation.makespan = now;
+    double slotTime = now * std::max(maxThreads, 0);
+    simulation.idleTime = slotTime - simulation.busyTime;
+    simulation.utilization =
+        slotTime > 0 ? simulation.busyTime / slotTime : 0;
+    return simulation;
+}
+
 }  // namespace TaskGraph
\ No newline at end of file
@@ -1,88 +1,595 @@
 #include "variables.h"
 
+#include <fnmatch.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "string-ops.h"
+
+namespace {
+
+/* Names of the functions that `$(function arguments)` can call. */
+const std::set<std::string> FUNCTIONS = {"file", "patsubst", "shell",
+                                         "sort", "subst",    "wildcard"};
+
+/**
+ * @brief Returns the whitespace-separated words of the text.
+ *
+ */
+std::vector<std::string> words(std::string text) {
+    std::replace(text.begin(), text.end(), '\t', ' ');
+    std::replace(text.begin(), text.end(), '\n', ' ');
+    return StringOps::split(text, ' ');
+}
+
+}  // namespace
+
 /**
- * @brief Store the value and lineno for the given variable name. Overwrites any
- * previous data for the same name. No restriction on argument values.
+ * @brief Store the value, lineno and flavor for the given variable name.
+ * Overwrites any previous data for the same name. No restriction on argument
+ * values. The value of a simply expanded variable must already be expanded.
  *
  */
 void Variables::addVariable(const std::string& name, const std::string& value,
-                            size_t lineno) {
+                            size_t lineno, Flavor flavor) {
     variables[name] = value;
     variableLinenos[name] = lineno;
+    variableFlavors[name] = flavor;
+}
+
+/**
+ * @brief Appends the value to the given variable's value, separated by a
+ * space. The appended value is expanded right away if the variable is simply
+ * expanded, and the variable keeps its flavor. An undefined variable is
+ * defined as recursively expanded. A variable defined only in an enclosing
+ * scope is copied into this scope first, so the enclosing value as of now is
+ * appended to without being changed.
+ *
+ * Throws an error if expanding the appended value fails.
+ *
+ */
+void Variables::appendVariable(const std::string& name,
+                               const std::string& value, size_t lineno) {
+    const Variables* scope = scopeOf(name);
+    if (!scope) {
+        addVariable(name, value, lineno);
+        return;
+    }
+    if (scope != this) {
+        addVariable(name, scope->variables.at(name), lineno,
+                    scope->variableFlavors.contains(name)
+                        ? scope->variableFlavors.at(name)
+                        : Flavor::Recursive);
+    }
+
+    std::string appended = value;
+    if (variableFlavors[name] == Flavor::Simple) {
+        appended = expandVariables(value, lineno);
+    }
+    if (!variables[name].empty() && !appended.empty()) {
+        variables[name] += ' ';
+    }
+    variables[name] += appended;
+}
+
+/**
+ * @brief Returns true if a value was added for the given variable name, in
+ * this scope or an enclosing one.
+ *
+ */
+bool Variables::defined(const std::string& name) const {
+    return scopeOf(name) != nullptr;
+}
+
+/**
+ * @brief Sets the directory that relative paths given to the file function
+ * are in, e.g. the directory of a sub-make.
+ *
+ */
+void Variables::setDirectory(const std::string& directory) {
+    this->directory = directory;
+}
+
+/**
+ * @brief Forgets what the file system and shell functions found, so that they
+ * look again the next time they are called, e.g. in a rebuild after files
+ * changed. Must not be called while variables are being expanded.
+ *
+ */
+void Variables::clearFunctionCache() {
+    FunctionCache& cache = *outermost().functionCache;
+    std::lock_guard lock(cache.mutex);
+    cache.directories.clear();
+    cache.commands.clear();
+}
+
+/**
+ * @brief Returns the innermost scope that defines the given variable name, or
+ * nullptr if none does. Scope chains are short, so this is a few lookups.
+ *
+ */
+const Variables* Variables::scopeOf(const std::string& name) const {
+    const Variables* scope = this;
+    while (scope && !scope->variables.contains(name)) {
+        scope = scope->parent;
+    }
+    return scope;
 }
 
 /**
  * @brief Expands each variable reference, denoted by $( ) or $. Within the
  * value of a variable reference, any variable reference is also recursively
- * expanded. If a `$` is the last character of the input, it is preserved and
- * not treated as a variable reference.
+ * expanded, and so is a name that contains variable references. If a `$` is
+ * the last character of the input, it is preserved and not treated as a
+ * variable reference. A reference of a function name, whitespace and
+ * arguments calls that function, see `callFunction`. The input is scanned
+ * once, so expansion takes time linear in the size of the input and output.
+ *
+ * The given automatic variables are looked up before the stored ones, without
+ * copying the stored ones. References within the value of a variable are
+ * looked up from this scope too, even if the variable is defined in an
+ * enclosing scope, so a scope's variables override those used by the
+ * enclosing ones. Expanding does not modify the variables, so it can
+ * be done from many threads at once.
  *
  * Throws an error if a variable reference has an opening but no closing
- * parenthesis or if any referenced variable is defined in terms of itself
- * during expansion.
+ * parenthesis, if any referenced variable is defined in terms of itself
+ * during expansion, or if a function fails.
+ *
+ */
+std::string Variables::expandVariables(
+    const std::string& input, size_t lineno,
+    const std::map<std::string, std::string>& automaticVariables) const {
+    Expansion expansion{.automaticVariables = automaticVariables};
+    return expand(input, lineno, expansion);
+}
+
+/**
+ * @brief Expands the input as part of the given `expandVariables` call.
  *
  */
-std::string Variables::expandVariables(const std::string& input,
-                                       size_t lineno) {
-    std::string output = "";
-    std::string remainingInput = input;
-    while (!remainingInput.empty()) {
+std::string Variables::expand(const std::string& input, size_t lineno,
+                              Expansion& expansion) const {
+    std::string output;
+    output.reserve(input.size());
+    size_t pos = 0;
+    while (pos < input.size()) {
         /* Go to the next variable. */
-        size_t dollarPos = remainingInput.find('$');
-        output += remainingInput.substr(0, dollarPos);
+        size_t dollarPos = input.find('$', pos);
         if (dollarPos == std::string::npos) {
             /* The entire input has been went through. */
+            output.append(input, pos);
             break;
         }
+        output.append(input, pos, dollarPos - pos);
+        pos = dollarPos + 1;
 
         /* Handle $ at the end of a line. */
-        remainingInput = remainingInput.substr(dollarPos + 1);
-        if (remainingInput.empty()) {
-            output += "$";
+        if (pos == input.size()) {
+            output += '$';
             break;
         }
 
         /* Capture variable name. */
         std::string currentName;
-        if (remainingInput.starts_with('(')) {
-            /* Parentheses-enclosed variable. */
-            size_t endParen = remainingInput.find(')');
+        if (input[pos] == '(') {
+            /* Parentheses-enclosed variable, which may contain nested
+             * references. */
+            size_t endParen = findClosingParen(input, pos);
             if (endParen == std::string::npos) {
                 /* No closing parenthesis means this is an invalid variable
                  * reference. */
                 throw VariablesException(
                     "%u: *** unterminated variable reference.  Stop.", lineno);
             }
-            currentName = remainingInput.substr(1, endParen - 1);
-            remainingInput = remainingInput.substr(endParen + 1);
+            currentName = input.substr(pos + 1, endParen - pos - 1);
+            pos = endParen + 1;
         } else {
             /* Single character variable. */
-            currentName = remainingInput.substr(0, 1);
-            remainingInput = remainingInput.substr(1);
+            currentName = input.substr(pos, 1);
+            pos++;
+        }
+
+        size_t space = currentName.find_first_of(" \t");
+        if (space != std::string::npos &&
+            FUNCTIONS.contains(currentName.substr(0, space))) {
+            output += callFunction(currentName.substr(0, space),
+                                   currentName.substr(space + 1), lineno,
+                                   expansion);
+            continue;
+        }
+        if (currentName.find('$') != std::string::npos) {
+            currentName = expand(currentName, lineno, expansion);
+        }
+
+        auto automatic = expansion.automaticVariables.find(currentName);
+        if (automatic != expansion.automaticVariables.end()) {
+            output += automatic->second;
+            continue;
         }
 
         /* Capture the line where this variable is defined. This is the new
          * lineno to blame for any error. If this variable has not been defined,
          * its lineno will correctly be 0. */
-        size_t currentLineno = variableLinenos[currentName];
+        const Variables* scope = scopeOf(currentName);
+        size_t currentLineno = 0;
+        if (scope) {
+            auto foundLineno = scope->variableLinenos.find(currentName);
+            if (foundLineno != scope->variableLinenos.end()) {
+                currentLineno = foundLineno->second;
+            }
+        }
 
         /* Discover if this variable name has been seen before. */
-        if (expandingVariables.contains(currentName)) {
+        if (expansion.expandingVariables.contains(currentName)) {
             throw VariablesException(
                 "%u: *** Recursive variable '%s' references itself "
                 "(eventually).  Stop.",
                 currentLineno, currentName.c_str());
         }
 
-        /* Expand any variables inside this name. If the name doesn't have a
-         * value, it will be an empty string and thus correctly not be expanded.
-         */
-        std::string currentValue = variables[currentName];
+        /* Expand any variables inside this name's value. An undefined name
+         * expands to nothing, and a simply expanded value was already expanded
+         * when it was defined. */
+        if (!scope) {
+            continue;
+        }
+        auto found = scope->variables.find(currentName);
+        auto flavor = scope->variableFlavors.find(currentName);
+        if (flavor != scope->variableFlavors.end() &&
+            flavor->second == Flavor::Simple) {
+            output += found->second;
+            continue;
+        }
 
-        expandingVariables.insert(currentName);
-        output += expandVariables(currentValue, currentLineno);
-        expandingVariables.erase(currentName);
+        expansion.expandingVariables.insert(currentName);
+        output += expand(found->second, currentLineno, expansion);
+        expansion.expandingVariables.erase(currentName);
     }
 
     return output;
+}
+
+/**
+ * @brief Returns the position of the parenthesis that closes the one at the
+ * given position, skipping over nested pairs, or std::string::npos if it is
+ * never closed.
+ *
+ */
+size_t Variables::findClosingParen(const std::string& input, size_t openPos) {
+    size_t depth = 0;
+    for (size_t i = openPos; i < input.size(); i++) {
+        if (input[i] == '(') {
+            depth++;
+        } else if (input[i] == ')' && --depth == 0) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+/**
+ * @brief Splits function arguments at the commas that are not inside a nested
+ * reference, into at most the given number of arguments. The last argument
+ * keeps any further commas.
+ *
+ */
+std::vector<std::string> Variables::splitArguments(const std::string& arguments,
+                                                   size_t maxArguments) {
+    std::vector<std::string> result;
+    size_t start = 0;
+    size_t depth = 0;
+    for (size_t i = 0; i < arguments.size() && result.size() + 1 < maxArguments;
+         i++) {
+        if (arguments[i] == '(') {
+            depth++;
+        } else if (arguments[i] == ')' && depth > 0) {
+            depth--;
+        } else if (arguments[i] == ',' && depth == 0) {
+            result.push_back(arguments.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    result.push_back(arguments.substr(start));
+    return result;
+}
+
+/**
+ * @brief Returns the outermost scope of this one's chain.
+ *
+ */
+const Variables& Variables::outermost() const {
+    const Variables* scope = this;
+    while (scope->parent) {
+        scope = scope->parent;
+    }
+    return *scope;
+}
+
+/**
+ * @brief Calls one of the functions in `FUNCTIONS` with the unexpanded
+ * arguments that followed its name, and returns its expansion. Like GNU make:
+ * - `$(wildcard patterns)` expands to the existing files that match each
+ *   pattern, see `wildcardFunction`.
+ * - `$(shell command)` expands to the output of the command, see
+ *   `shellFunction`.
+ * - `$(patsubst pattern,replacement,text)` replaces each word of the text that
+ *   matches the pattern, where a `%` matches any stem, with the replacement,
+ *   where a `%` stands for that stem.
+ * - `$(subst from,to,text)` replaces every occurrence of `from` in the text.
+ * - `$(sort list)` sorts the words of the list and drops duplicates.
+ * - `$(file ...)` is described at `fileFunction`.
+ *
+ * Throws an error if a function gets too few arguments or fails.
+ *
+ */
+std::string Variables::callFunction(const std::string& function,
+                                    const std::string& arguments,
+                                    size_t lineno,
+                                    Expansion& expansion) const {
+    if (function == "file") {
+        return fileFunction(arguments, lineno, expansion);
+    }
+
+    size_t numArguments =
+        function == "patsubst" || function == "subst" ? 3 : 1;
+    std::vector<std::string> expanded;
+    for (const std::string& argument :
+         splitArguments(arguments, numArguments)) {
+        expanded.push_back(expand(argument, lineno, expansion));
+    }
+    if (expanded.size() < numArguments) {
+        throw VariablesException(
+            "%u: *** insufficient number of arguments (%u) to function "
+            "'%s'.  Stop.",
+            lineno, expanded.size(), function.c_str());
+    }
+
+    if (function == "wildcard") {
+        return wildcardFunction(expanded[0]);
+    } else if (function == "shell") {
+        return shellFunction(expanded[0], lineno);
+    } else if (function == "subst") {
+        if (expanded[0].empty()) {
+            return expanded[2];
+        }
+        std::string output;
+        size_t pos = 0;
+        size_t found;
+        while ((found = expanded[2].find(expanded[0], pos)) !=
+               std::string::npos) {
+            output.append(expanded[2], pos, found - pos);
+            output += expanded[1];
+            pos = found + expanded[0].size();
+        }
+        output.append(expanded[2], pos);
+        return output;
+    } else if (function == "patsubst") {
+        std::string pattern = StringOps::trim(expanded[0]);
+        std::string replacement = StringOps::trim(expanded[1]);
+        size_t percentPos = pattern.find('%');
+        std::string prefix = pattern.substr(0, percentPos);
+        std::string suffix = percentPos == std::string::npos
+                                 ? ""
+                                 : pattern.substr(percentPos + 1);
+        size_t replacementPercent = replacement.find('%');
+        std::vector<std::string> output = words(expanded[2]);
+        for (std::string& word : output) {
+            if (percentPos == std::string::npos) {
+                if (word == pattern) {
+                    word = replacement;
+                }
+            } else if (word.size() >= prefix.size() + suffix.size() &&
+                       word.starts_with(prefix) && word.ends_with(suffix)) {
+                std::string stem = word.substr(
+                    prefix.size(), word.size() - prefix.size() - suffix.size());
+                word = replacementPercent == std::string::npos
+                           ? replacement
+                           : replacement.substr(0, replacementPercent) + stem +
+                                 replacement.substr(replacementPercent + 1);
+            }
+        }
+        return StringOps::join(output, ' ');
+    }
+
+    /* sort */
+    std::vector<std::string> sorted = words(expanded[0]);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    return StringOps::join(sorted, ' ');
+}
+
+/**
+ * @brief Implements `$(file op path[,text])`, which lets recipes hand long
+ * argument lists to commands through a response file instead of the command
+ * line. `>` writes the expanded text to the file, `>>` appends it, and a
+ * newline is added unless the text ends with one. Both expand to nothing. `<`
+ * expands to the contents of the file without a trailing newline.
+ *
+ * Throws an error for an unknown operation or a file that cannot be opened.
+ *
+ */
+std::string Variables::fileFunction(const std::string& arguments,
+                                    size_t lineno,
+                                    Expansion& expansion) const {
+    std::vector<std::string> split = splitArguments(arguments, 2);
+    std::string target = StringOps::trim(expand(split[0], lineno, expansion));
+
+    std::ios::openmode mode;
+    if (target.starts_with(">>")) {
+        mode = std::ios::app;
+        target = StringOps::trim(target.substr(2));
+    } else if (target.starts_with('>')) {
+        mode = std::ios::trunc;
+        target = StringOps::trim(target.substr(1));
+    } else if (target.starts_with('<')) {
+        mode = std::ios::in;
+        target = StringOps::trim(target.substr(1));
+    } else {
+        throw VariablesException(
+            "%u: *** file: invalid file operation: %s.  Stop.", lineno,
+            target.c_str());
+    }
+
+    std::string path =
+        (std::filesystem::path(outermost().directory) / target).string();
+
+    if (mode == std::ios::in) {
+        std::ifstream file(path);
+        if (!file) {
+            throw VariablesException("%u: *** open: %s: %s.  Stop.", lineno,
+                                     target.c_str(), strerror(errno));
+        }
+        std::string contents(std::istreambuf_iterator<char>(file), {});
+        if (contents.ends_with('\n')) {
+            contents.pop_back();
+        }
+        return contents;
+    }
+
+    std::ofstream file(path, std::ios::out | mode);
+    if (!file) {
+        throw VariablesException("%u: *** open: %s: %s.  Stop.", lineno,
+                                 target.c_str(), strerror(errno));
+    }
+    if (split.size() == 2) {
+        std::string text = expand(split[1], lineno, expansion);
+        file << text;
+        if (!text.ends_with('\n')) {
+            file << '\n';
+        }
+    }
+    return "";
+}
+
+/**
+ * @brief Implements `$(wildcard patterns)`, which expands to the existing
+ * files that match each whitespace-separated pattern, sorted per pattern.
+ * `*`, `?` and `[...]` match as in the shell, in any part of the path, and do
+ * not match a leading `.` of a name. Relative patterns are in the directory
+ * set by `setDirectory`, but the files are named as the pattern names them.
+ *
+ * Each directory is only scanned once per run, however many patterns look in
+ * it, so files created later in the run are not found.
+ *
+ */
+std::string Variables::wildcardFunction(const std::string& patterns) const {
+    std::filesystem::path directory = outermost().directory;
+    std::vector<std::string> output;
+    for (const std::string& pattern : words(patterns)) {
+        /* Match the pattern a component at a time, keeping the paths that
+         * match so far. */
+        std::vector<std::string> paths = {pattern.starts_with('/') ? "/" : ""};
+        for (const std::string& component : StringOps::split(pattern, '/')) {
+            std::vector<std::string> matches;
+            bool literal = component.find_first_of("*?[") == std::string::npos;
+            for (const std::string& path : paths) {
+                std::string prefix =
+                    path.empty() || path.ends_with('/') ? path : path + '/';
+                if (component == "." || component == "..") {
+                    matches.push_back(prefix + component);
+                    continue;
+                }
+                const std::vector<std::string>& names = scanDirectory(
+                    (directory / (path.empty() ? "." : path)).string());
+                if (literal) {
+                    if (std::binary_search(names.begin(), names.end(),
+                                           component)) {
+                        matches.push_back(prefix + component);
+                    }
+                    continue;
+                }
+                for (const std::string& name : names) {
+                    if (fnmatch(component.c_str(), name.c_str(),
+                                FNM_PERIOD) == 0) {
+                        matches.push_back(prefix + name);
+                    }
+                }
+            }
+            paths = std::move(matches);
+        }
+        if (pattern.ends_with('/')) {
+            for (std::string& path : paths) {
+                path += '/';
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        output.insert(output.end(), paths.begin(), paths.end());
+    }
+    return StringOps::join(output, ' ');
+}
+
+/**
+ * @brief Returns the sorted names in the directory at the path, or nothing if
+ * it is no directory. Only the first call for a path scans the directory.
+ *
+ */
+const std::vector<std::string>& Variables::scanDirectory(
+    const std::string& path) const {
+    FunctionCache& cache = *outermost().functionCache;
+    std::lock_guard lock(cache.mutex);
+    auto [found, added] = cache.directories.try_emplace(path);
+    if (added) {
+        std::error_code error;
+        for (std::filesystem::directory_iterator entry(path, error), end;
+             !error && entry != end; entry.increment(error)) {
+            found->second.push_back(entry->path().filename().string());
+        }
+        std::sort(found->second.begin(), found->second.end());
+    }
+    return found->second;
+}
+
+/**
+ * @brief Implements `$(shell command)`, which runs the command with /bin/sh in
+ * the directory set by `setDirectory` and expands to its output. Trailing
+ * newlines are dropped and other newlines become spaces. The command's stderr
+ * goes to this process's, and its exit status is ignored, as in GNU make.
+ *
+ * The same command is only run once per run, so a recursive variable that
+ * calls it can be referenced any number of times. Throws an error if the
+ * command cannot be started.
+ *
+ */
+std::string Variables::shellFunction(const std::string& command,
+                                     size_t lineno) const {
+    FunctionCache& cache = *outermost().functionCache;
+    {
+        std::lock_guard lock(cache.mutex);
+        auto found = cache.commands.find(command);
+        if (found != cache.commands.end()) {
+            return found->second;
+        }
+    }
+
+    /* The command runs unlocked, as it may take long. If another thread runs
+     * the same command meanwhile, the first output to be cached is kept. */
+    std::string script = command;
+    if (!outermost().directory.empty()) {
+        script = "cd '" + outermost().directory + "' || exit\n" + command;
+    }
+    FILE* pipe = popen(script.c_str(), "r");
+    if (!pipe) {
+        throw VariablesException("%u: *** shell: %s.  Stop.", lineno,
+                                 strerror(errno));
+    }
+    std::string output;
+    char buffer[4096];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        output.append(buffer, got);
+    }
+    pclose(pipe);
+    while (output.ends_with('\n')) {
+        output.pop_back();
+    }
+    std::replace(output.begin(), output.end(), '\n', ' ');
+
+    std::lock_guard lock(cache.mutex);
+    return cache.commands.try_emplace(command, output).first->second;
 }
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#include "executor.h"
+#include "remote-protocol.h"
+
+/**
+ * @brief Runs recipes sent by MiniMake processes that connect to the given
+ * address. Each connection is served on its own thread, so a worker can take
+ * one recipe per remote slot pointed at it. Recipes run in the worker's working
+ * directory, which should hold the same files as MiniMake's.
+ *
+ */
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " unix:path | [host]:port\n";
+        return 1;
+    }
+
+    int listenFd = RemoteProtocol::listenOn(argv[1]);
+    if (listenFd == -1) {
+        perror((std::string("listen failed for ") + argv[1]).c_str());
+        return 1;
+    }
+
+    while (true) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept failed");
+            return 1;
+        }
+        std::thread(Worker::serve, fd).detach();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+
+#include "action-cache.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+namespace {
+
+void writeFile(const std::string& path, const std::string& contents) {
+    std::ofstream file(path);
+    file << contents;
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+}  // namespace
+
+TEST(ActionCache, key) {
+    std::string directory = "tests/cacheKey";
+    std::filesystem::remove_all(directory);
+    writeFile("tests/cacheKeySrc", "one");
+
+    ActionCache cache(directory, 0);
+    std::string key = cache.key("out", {"cp in out"}, {"tests/cacheKeySrc"});
+    EXPECT_EQ(key.size(), 64);
+    EXPECT_EQ(key, cache.key("out", {"cp in out"}, {"tests/cacheKeySrc"}));
+
+    /* The recipes, target and prerequisites all change the key. */
+    EXPECT_NE(key, cache.key("out", {"cp in  out"}, {"tests/cacheKeySrc"}));
+    EXPECT_NE(key, cache.key("out2", {"cp in out"}, {"tests/cacheKeySrc"}));
+    EXPECT_NE(key, cache.key("out", {"cp", "in out"}, {"tests/cacheKeySrc"}));
+    EXPECT_NE(key, cache.key("out", {"cp in out"}, {}));
+
+    /* So do the contents of the prerequisites. */
+    writeFile("tests/cacheKeySrc", "two");
+    EXPECT_NE(key, cache.key("out", {"cp in out"}, {"tests/cacheKeySrc"}));
+
+    std::filesystem::remove("tests/cacheKeySrc");
+    std::filesystem::remove_all(directory);
+}
+
+TEST(ActionCache, store_restore) {
+    std::string directory = "tests/cacheStore";
+    std::filesystem::remove_all(directory);
+    std::string target = "tests/cacheStoreOut";
+
+    ActionCache cache(directory, 0);
+    EXPECT_FALSE(cache.restore("key", target));
+
+    /* Missing targets are not stored. */
+    std::filesystem::remove(target);
+    cache.store("key", target);
+    EXPECT_FALSE(cache.restore("key", target));
+
+    writeFile(target, "built");
+    cache.store("key", target);
+    writeFile(target, "changed");
+    EXPECT_TRUE(cache.restore("key", target));
+    EXPECT_EQ(readFile(target), "built");
+
+    std::filesystem::remove(target);
+    std::filesystem::remove_all(directory);
+}
+
+TEST(ActionCache, evict) {
+    std::string directory = "tests/cacheEvict";
+    std::filesystem::remove_all(directory);
+    std::string target = "tests/cacheEvictOut";
+    writeFile(target, "12345");
+
+    ActionCache cache(directory, 10);
+    cache.store("a", target);
+    cache.store("b", target);
+    cache.store("c", target);
+
+    /* Make `a` the most recently used entry, then `c`, so `b` is evicted. */
+    auto now = std::filesystem::file_time_type::clock::now();
+    std::filesystem::last_write_time(directory + "/b",
+                                     now - std::chrono::seconds(3));
+    std::filesystem::last_write_time(directory + "/c",
+                                     now - std::chrono::seconds(2));
+    std::filesystem::last_write_time(directory + "/a",
+                                     now - std::chrono::seconds(1));
+    EXPECT_TRUE(cache.restore("c", target));
+    cache.evict();
+
+    EXPECT_TRUE(std::filesystem::exists(directory + "/a"));
+    EXPECT_FALSE(std::filesystem::exists(directory + "/b"));
+    EXPECT_TRUE(std::filesystem::exists(directory + "/c"));
+
+    std::filesystem::remove(target);
+    std::filesystem::remove_all(directory);
+}
\ No newline at end of file
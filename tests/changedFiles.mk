@@ -0,0 +1,9 @@
+# Prerequisites that name a changed file by another path still depend on it,
+# including those of pattern rules matched after the changed files are known.
+tests/changedAll: tests/changedOut tests/changedPat.out
+
+tests/changedOut: ./tests/changedSrc tests/../tests/changedOther
+	cat tests/changedSrc tests/changedOther > tests/changedOut
+
+tests/%.out: ./tests/%.in
+	cp $< $@
\ No newline at end of file
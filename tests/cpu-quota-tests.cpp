@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+
+#include "cpu-quota.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+namespace {
+
+void writeCpuMax(const std::string& directory, const std::string& contents) {
+    std::filesystem::create_directories(directory);
+    std::ofstream(directory + "/cpu.max") << contents;
+}
+
+}  // namespace
+
+TEST(CpuQuota, cgroup) {
+    std::string root = "tests/cgroup";
+    writeCpuMax(root, "max 100000\n");
+    writeCpuMax(root + "/a", "250000 100000\n");
+    writeCpuMax(root + "/a/b", "max 100000\n");
+    std::filesystem::create_directories(root + "/c");
+
+    /* The tightest quota of the cgroup and its ancestors, rounded up. */
+    EXPECT_EQ(CpuQuota::cgroupCpus(root, "/a/b"), 3);
+    EXPECT_EQ(CpuQuota::cgroupCpus(root, "/a"), 3);
+    writeCpuMax(root + "/a/b", "100000 100000\n");
+    EXPECT_EQ(CpuQuota::cgroupCpus(root, "/a/b"), 1);
+
+    /* A fraction of a CPU still gets one. */
+    writeCpuMax(root + "/a/b", "5000 100000\n");
+    EXPECT_EQ(CpuQuota::cgroupCpus(root, "/a/b"), 1);
+
+    /* No quota anywhere, or no cgroup files at all. */
+    EXPECT_FALSE(CpuQuota::cgroupCpus(root, "/c").has_value());
+    EXPECT_FALSE(CpuQuota::cgroupCpus("tests/notpresent", "/a").has_value());
+    std::filesystem::remove_all(root);
+}
+
+TEST(CpuQuota, available) {
+    EXPECT_GE(CpuQuota::affinityCpus(), 1);
+    EXPECT_EQ(CpuQuota::affinityCpus(), CpuQuota::affinityCpuList().size());
+    EXPECT_GE(CpuQuota::availableCpus(), 1);
+    EXPECT_LE(CpuQuota::availableCpus(), CpuQuota::affinityCpus());
+}
+
+TEST(CpuQuota, parseCpuList) {
+    EXPECT_EQ(CpuQuota::parseCpuList("0-3,8,10-11\n"),
+              std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(CpuQuota::parseCpuList("2,x,5-"), std::vector<int>({2}));
+    EXPECT_EQ(CpuQuota::parseCpuList(""), std::vector<int>());
+}
+
+TEST(CpuQuota, numaNodes) {
+    /* Only CPUs this process may use count, and nodes without any are left
+     * out. */
+    std::vector<int> allowed = CpuQuota::affinityCpuList();
+    ASSERT_FALSE(allowed.empty());
+    std::string root = "tests/numa";
+    std::filesystem::create_directories(root + "/node0");
+    std::filesystem::create_directories(root + "/node1");
+    std::filesystem::create_directories(root + "/nodes");
+    std::ofstream(root + "/node0/cpulist") << "1024-2047\n";
+    std::ofstream(root + "/node1/cpulist") << "0-1023\n";
+    EXPECT_EQ(CpuQuota::numaNodes(root),
+              std::vector<std::vector<int>>({allowed}));
+    std::filesystem::remove_all(root);
+
+    /* Without NUMA information, all CPUs are on one node. */
+    EXPECT_EQ(CpuQuota::numaNodes("tests/notpresent"),
+              std::vector<std::vector<int>>({allowed}));
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "dag-analysis.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+TEST(DagAnalysis, analyze) {
+    /* Task tree, plus a task defined twice and a parent that is no task.
+     *      1
+     *   /     \
+     *  3c     2
+     *       /   \
+     *      3b   3a
+     */
+    std::vector<TaskGraph::Task> tasks = {{"1", {"3c", "2"}},
+                                          {"2", {"3a", "3b", "missing"}},
+                                          {"3a", {}},
+                                          {"3b", {}},
+                                          {"3c", {}},
+                                          {"3c", {"3a"}}};
+    DagAnalysis::Report report = DagAnalysis::analyze(tasks);
+    EXPECT_EQ(report.numNodes, 5);
+    EXPECT_EQ(report.numEdges, 4);
+    EXPECT_EQ(report.levelWidths, std::vector<size_t>({3, 1, 1}));
+    EXPECT_EQ(report.levels["1"], 2);
+    EXPECT_EQ(report.criticalPathWeight, 3);
+    EXPECT_EQ(report.totalWeight, 5);
+    EXPECT_EQ(report.criticalPath.size(), 3);
+    EXPECT_EQ(report.criticalPath.back(), "1");
+
+    /* Durations move the critical path to the slowest chain, and tasks
+     * without one weigh nothing. */
+    report = DagAnalysis::analyze(tasks, {{"3c", 10}, {"3b", 1}, {"1", 2}});
+    EXPECT_EQ(report.criticalPath, std::vector<std::string>({"3c", "1"}));
+    EXPECT_EQ(report.criticalPathWeight, 12);
+    EXPECT_EQ(report.totalWeight, 13);
+}
+
+TEST(DagAnalysis, readDurations) {
+    std::string path = "tests/durations.csv";
+    std::ofstream(path) << "target,seconds\na,1.5\nb,2,extra\nbad\n";
+    EXPECT_EQ(DagAnalysis::readDurations(path),
+              (std::map<std::string, double>({{"a", 1.5}, {"b", 2}})));
+    std::remove(path.c_str());
+    EXPECT_TRUE(DagAnalysis::readDurations(path).empty());
+}
+
+TEST(DagAnalysis, write) {
+    std::vector<TaskGraph::Task> tasks = {{"a", {"b"}}, {"b", {}}};
+    DagAnalysis::Report report = DagAnalysis::analyze(tasks);
+
+    std::ostringstream dot;
+    DagAnalysis::writeDot(dot, tasks, report);
+    EXPECT_NE(dot.str().find("\"b\" -> \"a\" [color=red];"), std::string::npos);
+
+    std::ostringstream json;
+    DagAnalysis::writeJson(json, tasks, report);
+    EXPECT_NE(json.str().find("\"criticalPath\": [\"b\", \"a\"]"),
+              std::string::npos);
+}
+
+TEST(DagAnalysis, shard) {
+    /* Goals that share a prerequisite go to the same shard when that adds
+     * less than another shard would. */
+    std::vector<TaskGraph::Task> tasks = {
+        {"b", {}}, {"x", {"c"}}, {"y", {"c"}}, {"c", {}}};
+    std::map<std::string, double> durations = {
+        {"b", 5}, {"x", 1}, {"y", 1}, {"c", 4}};
+    using Shards = std::vector<std::vector<std::string>>;
+    EXPECT_EQ(DagAnalysis::shard(tasks, {"b", "x", "y"}, 2, durations),
+              Shards({{"b"}, {"x", "y"}}));
+
+    /* Goals are split into their prerequisites while there are fewer than
+     * shards, even if that leaves shards with nothing to build. */
+    EXPECT_EQ(DagAnalysis::shard(tasks, {"b", "x", "y"}, 4, durations),
+              Shards({{"b"}, {"c"}, {}, {}}));
+
+    /* A goal too heavy for one shard is split into its prerequisites.
+     *          all
+     *      /    |    \
+     *    lib   app1   app2
+     *     |    /  \   /  \
+     *    l1   a1  common  a2
+     */
+    tasks = {{"all", {"lib", "app1", "app2"}},
+             {"lib", {"l1"}},
+             {"app1", {"common", "a1"}},
+             {"app2", {"common", "a2"}},
+             {"l1", {}},
+             {"a1", {}},
+             {"a2", {}},
+             {"common", {}}};
+    EXPECT_EQ(DagAnalysis::shard(tasks, {"all"}, 1), Shards({{"all"}}));
+    EXPECT_EQ(DagAnalysis::shard(tasks, {"all"}, 2),
+              Shards({{"app1", "lib"}, {"app2"}}));
+
+    /* Once there are enough, a goal a little heavier than its share is not
+     * split, so it is built by a shard rather than the final build. */
+    tasks = {{"g1", {"p1"}}, {"g2", {"p2"}}, {"p1", {}}, {"p2", {}}};
+    durations = {{"g1", 1}, {"p1", 5}, {"g2", 1}, {"p2", 3}};
+    EXPECT_EQ(DagAnalysis::shard(tasks, {"g1", "g2"}, 2, durations),
+              Shards({{"g1"}, {"g2"}}));
+}
+
+TEST(DagAnalysis, shard_layers) {
+    /* Layers of 100 tasks, each depending on the task below it and the first
+     * task of the layer before, under one goal. The goal is split into the top
+     * layer, whose subtrees share the first tasks of the layers. */
+    size_t numTasks = 100000;
+    size_t width = 100;
+    std::vector<TaskGraph::Task> tasks(numTasks);
+    for (size_t i = 0; i < numTasks; i++) {
+        tasks[i].task = std::to_string(i);
+        if (i >= width) {
+            tasks[i].parentTasks = {std::to_string(i - width),
+                                    std::to_string(i / width * width - width)};
+        }
+    }
+    TaskGraph::Task all{"all"};
+    for (size_t i = numTasks - width; i < numTasks; i++) {
+        all.parentTasks.push_back(std::to_string(i));
+    }
+    tasks.push_back(all);
+
+    size_t numShards = 16;
+    std::vector<std::vector<std::string>> shards =
+        DagAnalysis::shard(tasks, {"all"}, numShards);
+    size_t numTargets = 0;
+    for (const std::vector<std::string>& targets : shards) {
+        EXPECT_GE(targets.size(), width / numShards);
+        EXPECT_LE(targets.size(), width / numShards + 1);
+        numTargets += targets.size();
+    }
+    EXPECT_EQ(numTargets, width);
+}
\ No newline at end of file
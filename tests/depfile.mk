@@ -0,0 +1,6 @@
+# Includes dependency files like those written by `gcc -MMD`, whether or not
+# they exist yet.
+-include tests/depfiles/*.d tests/depfiles/missing.d
+
+tests/depfile.out:
+	@echo $@ depends on $^ $(DEPFILE_VAR)
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "cpu-quota.h"
+#include "executor.h"
+#include "remote-protocol.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+TEST(Executor, local) {
+    LocalExecutor executor;
+    EXPECT_EQ(executor.run("true"), 0);
+    EXPECT_EQ(executor.run("exit 3"), 3);
+    EXPECT_EQ(executor.run("kill -9 $$"), 128 + 9);
+
+    /* Recipes too long to be an argument are passed as a script. */
+    std::string longRecipe = "exit 5 #" + std::string(1 << 20, 'x');
+    EXPECT_EQ(executor.run(longRecipe), 5);
+
+    /* What the recipe and its children took is measured. */
+    ResourceUsage usage;
+    EXPECT_EQ(executor.run("sleep 0.1; head -c 10M /dev/zero | tail -c 1",
+                           &usage),
+              0);
+    EXPECT_GE(usage.wallSeconds, 0.1);
+    EXPECT_GT(usage.maxRssKilobytes, 0);
+    EXPECT_GT(usage.voluntarySwitches, 0);
+}
+
+TEST(Executor, started) {
+    auto reactor = std::make_shared<ProcessReactor>();
+    LocalExecutor executor(reactor);
+
+    /* Exit handlers are called as the recipes exit, not in start order. */
+    std::vector<int> statuses;
+    std::mutex mutex;
+    std::condition_variable exited;
+    auto onExit = [&](int status) {
+        std::lock_guard lock(mutex);
+        statuses.push_back(status);
+        exited.notify_one();
+    };
+    ResourceUsage usage;
+    executor.start("sleep 0.2; exit 2", onExit, &usage);
+    executor.start("exit 1", onExit);
+    executor.start("kill -9 $$", onExit);
+
+    std::unique_lock lock(mutex);
+    exited.wait(lock, [&] { return statuses.size() == 3; });
+    EXPECT_EQ(statuses.back(), 2);
+    EXPECT_EQ(std::count(statuses.begin(), statuses.end(), 128 + 9), 1);
+    EXPECT_GE(usage.wallSeconds, 0.2);
+}
+
+TEST(Executor, slow_handler) {
+    auto reactor = std::make_shared<ProcessReactor>(2);
+    LocalExecutor executor(reactor);
+
+    /* A handler that takes its time holds up neither the reactor nor the
+     * handler of a recipe that exits later. */
+    std::mutex mutex;
+    std::condition_variable exited;
+    bool slowDone = false;
+    bool fastDone = false;
+    executor.start("true", [&](int) {
+        std::unique_lock lock(mutex);
+        exited.wait_for(lock, std::chrono::seconds(10),
+                        [&] { return fastDone; });
+        slowDone = true;
+        exited.notify_all();
+    });
+    executor.start("sleep 0.1", [&](int) {
+        std::lock_guard lock(mutex);
+        fastDone = true;
+        exited.notify_all();
+    });
+
+    std::unique_lock lock(mutex);
+    exited.wait(lock, [&] { return slowDone; });
+    EXPECT_TRUE(fastDone);
+}
+
+TEST(Executor, work_queue) {
+    /* Queued work is still run when the queue is destroyed. */
+    std::atomic<int> done = 0;
+    {
+        WorkQueue queue(4);
+        for (int i = 0; i < 100; i++) {
+            queue.post([&done] { done++; });
+        }
+    }
+    EXPECT_EQ(done, 100);
+}
+
+TEST(Executor, frames) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    using RemoteProtocol::Frame;
+    EXPECT_TRUE(RemoteProtocol::sendFrame(fds[0], Frame::Recipe, "echo hi"));
+    EXPECT_TRUE(RemoteProtocol::sendFrame(fds[0], Frame::Exit, ""));
+
+    Frame type;
+    std::string payload;
+    EXPECT_TRUE(RemoteProtocol::receiveFrame(fds[1], type, payload));
+    EXPECT_EQ(type, Frame::Recipe);
+    EXPECT_EQ(payload, "echo hi");
+    EXPECT_TRUE(RemoteProtocol::receiveFrame(fds[1], type, payload));
+    EXPECT_EQ(type, Frame::Exit);
+    EXPECT_EQ(payload, "");
+
+    close(fds[0]);
+    EXPECT_FALSE(RemoteProtocol::receiveFrame(fds[1], type, payload));
+    close(fds[1]);
+}
+
+TEST(Executor, remote) {
+    std::string address = "unix:tests/executor.sock";
+    int listenFd = RemoteProtocol::listenOn(address);
+    ASSERT_NE(listenFd, -1);
+    std::jthread worker([listenFd] { Worker::serve(accept(listenFd, 0, 0)); });
+
+    {
+        RemoteExecutor executor(address);
+        testing::internal::CaptureStdout();
+        testing::internal::CaptureStderr();
+        EXPECT_EQ(executor.run("echo out; echo err >&2"), 0);
+        EXPECT_EQ(executor.run("exit 4"), 4);
+        EXPECT_EQ(testing::internal::GetCapturedStdout(), "out\n");
+        EXPECT_EQ(testing::internal::GetCapturedStderr(), "err\n");
+    }
+    worker.join();
+    close(listenFd);
+    unlink("tests/executor.sock");
+
+    /* Nothing listens anymore. */
+    RemoteExecutor executor(address);
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(executor.run("true"), -1);
+    testing::internal::GetCapturedStderr();
+}
+
+TEST(Executor, remote_directory) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    std::jthread worker([fd = fds[1]] { Worker::serve(fd); });
+
+    /* Recipes run in the directory that MiniMake sent. */
+    using RemoteProtocol::Frame;
+    EXPECT_TRUE(RemoteProtocol::sendFrame(fds[0], Frame::Directory, "/tmp"));
+    EXPECT_TRUE(RemoteProtocol::sendFrame(fds[0], Frame::Recipe, "pwd"));
+    Frame type;
+    std::string payload;
+    EXPECT_TRUE(RemoteProtocol::receiveFrame(fds[0], type, payload));
+    EXPECT_EQ(type, Frame::Stdout);
+    EXPECT_EQ(payload, "/tmp\n");
+    EXPECT_TRUE(RemoteProtocol::receiveFrame(fds[0], type, payload));
+    EXPECT_EQ(type, Frame::Exit);
+    EXPECT_EQ(payload, "0");
+    close(fds[0]);
+}
+
+TEST(Executor, remote_malformed) {
+    std::string address = "unix:tests/malformed.sock";
+    int listenFd = RemoteProtocol::listenOn(address);
+    ASSERT_NE(listenFd, -1);
+
+    /* A worker that answers with a status that is not a number. */
+    std::jthread worker([listenFd] {
+        using RemoteProtocol::Frame;
+        int fd = accept(listenFd, 0, 0);
+        Frame type;
+        std::string payload;
+        while (RemoteProtocol::receiveFrame(fd, type, payload) &&
+               type != Frame::Recipe) {
+        }
+        RemoteProtocol::sendFrame(fd, Frame::Exit, "oops");
+        RemoteProtocol::receiveFrame(fd, type, payload);
+        close(fd);
+    });
+
+    /* It is treated as a lost connection, not a crash. */
+    RemoteExecutor executor(address);
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(executor.run("true"), -1);
+    EXPECT_NE(testing::internal::GetCapturedStderr().find("Lost connection"),
+              std::string::npos);
+    EXPECT_EQ(executor.fd, -1);
+    worker.join();
+    close(listenFd);
+    unlink("tests/malformed.sock");
+}
+
+TEST(Executor, pool) {
+    ExecutorPool pool(1, {"unix:tests/none.sock"});
+    EXPECT_EQ(pool.size(), 2);
+
+    /* Local executors are handed out first. */
+    std::shared_ptr<Executor> first = pool.acquire();
+    EXPECT_NE(dynamic_cast<LocalExecutor*>(first.get()), nullptr);
+    std::shared_ptr<Executor> second = pool.acquire();
+    EXPECT_NE(dynamic_cast<RemoteExecutor*>(second.get()), nullptr);
+
+    /* Returned executors can be borrowed again. */
+    first.reset();
+    EXPECT_EQ(pool.acquire().get(), pool.executors.back().get());
+
+    EXPECT_EQ(ExecutorPool(0, {}).size(), 1);
+}
+
+TEST(Executor, pool_limit) {
+    ExecutorPool pool(2, {"unix:tests/none.sock"});
+    pool.localLimit = 1;
+
+    /* Past the limit, only remote executors are lent out. */
+    std::shared_ptr<Executor> first = pool.acquire();
+    EXPECT_NE(dynamic_cast<LocalExecutor*>(first.get()), nullptr);
+    std::shared_ptr<Executor> second = pool.acquire();
+    EXPECT_NE(dynamic_cast<RemoteExecutor*>(second.get()), nullptr);
+    EXPECT_EQ(pool.numLocalBorrowed, 1);
+
+    first.reset();
+    EXPECT_EQ(pool.numLocalBorrowed, 0);
+    EXPECT_NE(dynamic_cast<LocalExecutor*>(pool.acquire().get()), nullptr);
+
+    /* A pool that follows the quota never lends out more local executors
+     * than there are CPUs available. */
+    ExecutorPool quotaPool(64, {}, true);
+    EXPECT_EQ(quotaPool.size(), 64);
+    EXPECT_GE(quotaPool.localLimit, 1);
+    EXPECT_LE(quotaPool.localLimit, 64);
+}
+
+TEST(Executor, placement) {
+    /* Recipes only run on the CPUs of the executor. */
+    std::vector<int> cpus = CpuQuota::affinityCpuList();
+    LocalExecutor executor(nullptr, {cpus.back()});
+    EXPECT_EQ(executor.run("[ \"$(nproc)\" = 1 ]"), 0);
+
+    /* A task goes to the node where its parents ran if it can. */
+    ExecutorPool pool(2, {}, false, ExecutorPool::Placement::Numa);
+    pool.numNodes = 2;
+    pool.nodes = {{pool.executors[0].get(), 0}, {pool.executors[1].get(), 1}};
+    std::shared_ptr<Executor> a = pool.acquire("a");
+    std::shared_ptr<Executor> c = pool.acquire("c");
+    EXPECT_EQ(pool.getTaskNodes(),
+              (std::unordered_map<std::string, int>({{"a", 1}, {"c", 0}})));
+    a.reset();
+    c.reset();
+    EXPECT_EQ(pool.acquire("d", {"a", "b"}).get(), pool.executors[1].get());
+    EXPECT_EQ(pool.getTaskNodes()["d"], 1);
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+
+#include "file-status.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+TEST(FileStatus, prefetch_modifiedTime) {
+    FileStatus status;
+    std::vector<std::string> paths = {"tests/empty.mk", "tests/notpresent.file",
+                                      "tests/empty.mk"};
+    for (int i = 0; i < 600; i++) {
+        paths.push_back("tests/notpresent" + std::to_string(i));
+    }
+    status.prefetch(paths);
+
+    EXPECT_EQ(status.modifiedTimes.size(), 602);
+    EXPECT_TRUE(status.modifiedTime("tests/empty.mk").has_value());
+    EXPECT_FALSE(status.modifiedTime("tests/notpresent.file").has_value());
+    EXPECT_FALSE(status.modifiedTime("tests/notpresent599").has_value());
+
+    /* Files that were not prefetched are looked up on demand. */
+    EXPECT_TRUE(status.modifiedTime("tests/comment.mk").has_value());
+    EXPECT_EQ(status.modifiedTimes.size(), 603);
+}
+
+TEST(FileStatus, refresh) {
+    std::string newfile = "tests/new.file";
+    std::remove(newfile.c_str());
+
+    FileStatus status;
+    EXPECT_FALSE(status.modifiedTime(newfile).has_value());
+
+    /* The remembered status is kept until it is refreshed. */
+    std::ofstream file(newfile);
+    file.close();
+    EXPECT_FALSE(status.modifiedTime(newfile).has_value());
+    status.refresh(newfile);
+    EXPECT_TRUE(status.modifiedTime(newfile).has_value());
+
+    std::remove(newfile.c_str());
+}
\ No newline at end of file
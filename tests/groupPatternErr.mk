@@ -0,0 +1,2 @@
+%.a %.b &: %.c
+	echo $@
\ No newline at end of file
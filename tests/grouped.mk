@@ -0,0 +1,7 @@
+# Grouped targets. One run of the generator writes both outputs, so it runs
+# once even when both are needed, and again when either output is missing.
+tests/groupOut: tests/groupA tests/groupB
+	cat tests/groupA tests/groupB > tests/groupOut
+
+tests/groupA tests/groupB &: tests/groupSrc
+	echo a > tests/groupA; echo b > tests/groupB
\ No newline at end of file
@@ -0,0 +1,2 @@
+# Error: included makefile does not exist.
+include tests/nonexistent.mk
\ No newline at end of file
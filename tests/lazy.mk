@@ -0,0 +1,5 @@
+LOOP = $(LOOP)
+
+# Only outdated targets have their recipes expanded.
+tests/lazy.mk:
+	echo $(LOOP)
\ No newline at end of file
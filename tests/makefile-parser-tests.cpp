@@ -69,8 +69,17 @@ TEST(MakefileParser, hasCircularDependency) {
 
     EXPECT_FALSE(parser.hasCircularDependency(target));
 
+    /* Forget the targets found to be acyclic before changing the graph. */
     parser.makefilePrereqs["p3"] = {"p2"};
+    parser.acyclicTargets.clear();
     EXPECT_TRUE(parser.hasCircularDependency(target));
+
+    /* A target reached on two paths is not a cycle. */
+    parser.makefilePrereqs = {
+        {"all", {"prog", "lib"}}, {"prog", {"lib"}}, {"lib", {"src"}}};
+    parser.acyclicTargets.clear();
+    EXPECT_FALSE(parser.hasCircularDependency("all"));
+    EXPECT_TRUE(parser.acyclicTargets.contains("src"));
 }
 
 TEST(MakefileParser, outdated) {
@@ -80,20 +89,190 @@ TEST(MakefileParser, outdated) {
     file.close();
 
     std::string oldfile = "tests/empty.mk";
-    MakefileParser parser(oldfile);
+    auto parser = std::make_shared<MakefileParser>(oldfile);
 
-    EXPECT_TRUE(parser.outdated("notpresent.file"));
+    std::string missing = "notpresent.file";
+    EXPECT_TRUE(parser->snapshot({missing})->outdated(missing));
 
-    parser.makefilePrereqs = {{newfile, {oldfile}}};
-    EXPECT_FALSE(parser.outdated(newfile));
+    parser->makefilePrereqs = {{newfile, {oldfile}}};
+    EXPECT_FALSE(parser->snapshot({newfile, oldfile})->outdated(newfile));
 
-    parser.makefilePrereqs = {{oldfile, {newfile}}};
-    EXPECT_TRUE(parser.outdated(oldfile));
+    parser->makefilePrereqs = {{oldfile, {newfile}}};
+    EXPECT_TRUE(parser->snapshot({newfile, oldfile})->outdated(oldfile));
 
     // Delete the temporary file
     std::remove(newfile.c_str());
 }
 
+TEST(MakefileParser, changedFiles) {
+    auto parser = std::make_shared<MakefileParser>("tests/test.mk");
+    parser->setChangedFiles({"./tests/deps3"});
+    parser->getPrereqs("tests/deps");
+    parser->getPrereqs("tests/deps1");
+    std::vector<std::string> targets = {"tests/deps", "tests/deps1",
+                                        "tests/deps2", "tests/deps3"};
+    parser->prefetchFileStatus(targets);
+
+    /* Only the dependents of changed files are outdated, and no file is
+     * looked up to find out, even if it does not exist. */
+    std::shared_ptr<const MakefileSnapshot> snapshot =
+        parser->snapshot(targets);
+    EXPECT_TRUE(snapshot->outdated("tests/deps"));
+    EXPECT_TRUE(snapshot->outdated("tests/deps2"));
+    EXPECT_FALSE(snapshot->outdated("tests/deps1"));
+    EXPECT_FALSE(snapshot->outdated("tests/deps3"));
+    EXPECT_TRUE(parser->fileStatus.modifiedTimes.empty());
+
+    parser->setChangedFiles({});
+    parser->prefetchFileStatus({});
+    EXPECT_FALSE(parser->snapshot(targets)->outdated("tests/deps"));
+}
+
+TEST(MakefileParser, changedFiles_paths) {
+    /* Changed files match prerequisites that name them by another path. */
+    std::vector<std::string> sources = {
+        "tests/changedSrc", "tests/changedOther", "tests/changedPat.in"};
+    for (const std::string& source : sources) {
+        std::ofstream(source) << "source\n";
+    }
+    auto parser = std::make_shared<MakefileParser>("tests/changedFiles.mk");
+    parser->setChangedFiles({"tests/changedOther", "tests/changedPat.in"});
+    parser->getPrereqs("tests/changedOut");
+    parser->prefetchFileStatus({});
+    EXPECT_TRUE(parser->snapshot({"tests/changedOut"})
+                    ->outdated("tests/changedOut"));
+
+    /* Pattern rules matched since are indexed too. */
+    parser->getPrereqs("tests/changedAll");
+    parser->prefetchFileStatus({});
+    std::shared_ptr<const MakefileSnapshot> snapshot =
+        parser->snapshot({"tests/changedAll", "tests/changedPat.out"});
+    EXPECT_TRUE(snapshot->outdated("tests/changedPat.out"));
+    EXPECT_TRUE(snapshot->outdated("tests/changedAll"));
+
+    parser->setChangedFiles({"./tests/changedSrc"});
+    parser->prefetchFileStatus({});
+    snapshot = parser->snapshot({"tests/changedOut", "tests/changedPat.out"});
+    EXPECT_TRUE(snapshot->outdated("tests/changedOut"));
+    EXPECT_FALSE(snapshot->outdated("tests/changedPat.out"));
+
+    for (const std::string& source : sources) {
+        std::remove(source.c_str());
+    }
+}
+
+TEST(MakefileParser, grouped) {
+    std::ofstream("tests/groupSrc").close();
+    std::ofstream("tests/groupA").close();
+    auto parser = std::make_shared<MakefileParser>("tests/grouped.mk");
+    std::vector<std::string> group = {"tests/groupA", "tests/groupB"};
+    EXPECT_EQ(parser->getGroup("tests/groupA"), group);
+    EXPECT_EQ(parser->getGroup("tests/groupB"), group);
+    EXPECT_EQ(parser->getGroup("tests/groupOut"),
+              std::vector<std::string>({"tests/groupOut"}));
+    EXPECT_EQ(parser->getPrereqs("tests/groupB"),
+              std::vector<std::string>({"tests/groupSrc"}));
+
+    /* A group is outdated if any of its targets is. */
+    parser->makefilePrereqs["tests/groupA"].clear();
+    std::shared_ptr<const MakefileSnapshot> snapshot = parser->snapshot(group);
+    EXPECT_FALSE(snapshot->outdatedFile("tests/groupA"));
+    EXPECT_TRUE(snapshot->outdated("tests/groupA"));
+    std::remove("tests/groupSrc");
+    std::remove("tests/groupA");
+}
+
+TEST(MakefileParser, orderOnly_phony) {
+    std::ofstream("tests/orderSrc").close();
+    std::ofstream("tests/orderAll").close();
+    auto parser = std::make_shared<MakefileParser>("tests/orderOnly.mk");
+    EXPECT_EQ(parser->getPrereqs("tests/orderDir/obj"),
+              std::vector<std::string>({"tests/orderSrc"}));
+    EXPECT_EQ(parser->getOrderOnlyPrereqs("tests/orderDir/obj"),
+              std::vector<std::string>({"tests/orderDir"}));
+    EXPECT_EQ(
+        std::get<0>(parser->getRecipes("tests/orderDir/obj")),
+        std::vector<std::string>({"cp tests/orderSrc tests/orderDir/obj"}));
+
+    /* An existing file does not make a phony target up to date. */
+    EXPECT_TRUE(parser->isPhony("tests/orderAll"));
+    std::shared_ptr<const MakefileSnapshot> snapshot =
+        parser->snapshot({"tests/orderAll"});
+    EXPECT_TRUE(snapshot->outdated("tests/orderAll"));
+    EXPECT_FALSE(snapshot->modifiedTime("tests/orderAll").has_value());
+
+    /* Order-only prerequisites are part of dependency cycles. */
+    parser->makefileOrderOnlyPrereqs["tests/orderSrc"] = {"tests/orderDir/obj"};
+    parser->acyclicTargets.clear();
+    EXPECT_TRUE(parser->hasCircularDependency("tests/orderDir/obj"));
+    std::remove("tests/orderSrc");
+    std::remove("tests/orderAll");
+}
+
+TEST(MakefileParser, matchPatternRule) {
+    MakefileParser parser("tests/empty.mk");
+    parser.addPatternRule("%.o", {"%.c"});
+    parser.addPatternRule("obj/%.o", {"src/%.c"});
+    parser.addPatternRule("obj/%.o", {"gen/%.c"});
+    parser.addPatternRule("lib%.a", {});
+    parser.makefilePrereqs = {{"a.c", {}}, {"src/b.c", {}}, {"gen/c.c", {}}};
+
+    using Match = std::optional<std::tuple<size_t, std::string>>;
+    EXPECT_EQ(parser.matchPatternRule("a.o", 0), Match({0, "a"}));
+    EXPECT_EQ(parser.matchPatternRule("libx.a", 0), Match({3, "x"}));
+
+    /* The shortest stem wins, then the first rule whose prereqs exist. */
+    EXPECT_EQ(parser.matchPatternRule("obj/b.o", 0), Match({1, "b"}));
+    EXPECT_EQ(parser.matchPatternRule("obj/c.o", 0), Match({2, "c"}));
+
+    /* Stems must be non-empty and prereqs must be buildable. */
+    EXPECT_EQ(parser.matchPatternRule("lib.a", 0), std::nullopt);
+    EXPECT_EQ(parser.matchPatternRule("d.o", 0), std::nullopt);
+    EXPECT_EQ(parser.matchPatternRule("a.c", 0), std::nullopt);
+
+    /* Resolving a target gives it the pattern rule's prereqs and stem. */
+    parser.resolvePatternRule("a.o");
+    EXPECT_EQ(parser.getPrereqs("a.o"), std::vector<std::string>({"a.c"}));
+    EXPECT_EQ(parser.makefileStems["a.o"], "a");
+}
+
+TEST(MakefileParser, parseDepfile) {
+    MakefileParser parser("tests/empty.mk");
+    EXPECT_TRUE(parser.parseDepfile("tests/depfiles/a.d"));
+    EXPECT_EQ(parser.makefilePrereqs["tests/depfile.out"],
+              std::vector<std::string>(
+                  {"tests/depfile with space.h", "tests/test.mk"}));
+    EXPECT_EQ(parser.makefilePrereqs["tests/depfile with space.h"],
+              std::vector<std::string>({}));
+
+    /* Files with anything but rules without recipes are left alone. */
+    EXPECT_FALSE(parser.parseDepfile("tests/depfiles/b.d"));
+    EXPECT_EQ(parser.makefilePrereqs.size(), 2);
+    EXPECT_FALSE(parser.parseDepfile("tests/test.mk"));
+}
+
+TEST(MakefileParser, getPool) {
+    MakefileParser parser("tests/test.mk");
+    EXPECT_EQ(parser.getPool("pooledA"), "heavy");
+    EXPECT_EQ(parser.getPool("pooledC"), "");
+    EXPECT_EQ(parser.getPoolDepths(),
+              (std::map<std::string, size_t>({{"heavy", 1}})));
+    EXPECT_FALSE(parser.makefilePrereqs.contains(".POOL.heavy"));
+}
+
+TEST(MakefileParser, directory) {
+    /* Paths are relative to the given directory, as for a sub-make. */
+    auto parser = std::make_shared<MakefileParser>("Makefile", "tests/submake");
+    EXPECT_EQ(parser->getPrereqs("out"), std::vector<std::string>({"in"}));
+    std::shared_ptr<const MakefileSnapshot> snapshot =
+        parser->snapshot({"out", "in", "Makefile"});
+    EXPECT_TRUE(snapshot->outdated("out"));
+    EXPECT_FALSE(snapshot->outdated("Makefile"));
+    EXPECT_EQ(snapshot->getDirectory(), "tests/submake");
+    EXPECT_EQ(parser->makefileVars.expandVariables("$(MAKE)", 0),
+              MakefileParser::makeCommand());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "makefile-parser.h"
+#include "makefile-snapshot.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+TEST(MakefileSnapshot, lookups) {
+    auto parser = std::make_shared<MakefileParser>("tests/test.mk");
+    std::vector<std::string> targets = {"autoVars", "tests/deps1",
+                                        "tests/deps2", "tests/deps3", "badvar"};
+    for (const std::string& target : targets) {
+        parser->getPrereqs(target);
+    }
+    std::shared_ptr<const MakefileSnapshot> snapshot =
+        parser->snapshot(targets);
+
+    /* The snapshot keeps the parser alive for its variables, so it can only
+     * be taken of a shared parser. */
+    MakefileParser unshared("tests/test.mk");
+    EXPECT_THROW(unshared.snapshot(targets), std::bad_weak_ptr);
+    parser.reset();
+    EXPECT_EQ(snapshot->getPrereqs("autoVars"),
+              std::vector<std::string>(
+                  {"tests/deps1", "tests/deps2", "tests/deps3"}));
+    EXPECT_EQ(std::get<0>(snapshot->expandRecipes("autoVars")),
+              std::vector<std::string>(
+                  {"echo target: autoVars, first prereq: tests/deps1, all "
+                   "prereqs: tests/deps1 tests/deps2 tests/deps3"}));
+    EXPECT_THROW(snapshot->expandRecipes("badvar"),
+                 MakefileParser::MakefileParserException);
+
+    /* Targets outside of the snapshot are files without rules. */
+    EXPECT_TRUE(snapshot->getPrereqs("basic").empty());
+    EXPECT_TRUE(std::get<0>(snapshot->expandRecipes("basic")).empty());
+    EXPECT_EQ(snapshot->getGroup("basic"), std::vector<std::string>({"basic"}));
+    EXPECT_FALSE(snapshot->isPhony("basic"));
+    EXPECT_TRUE(snapshot->outdated("tests/notpresent.file"));
+    EXPECT_FALSE(snapshot->outdated("tests/test.mk"));
+}
+
+TEST(MakefileSnapshot, concurrent) {
+    auto parser = std::make_shared<MakefileParser>("tests/test.mk");
+    std::vector<std::string> targets = {"autoVars", "tests/deps",
+                                        "tests/deps1", "tests/deps2",
+                                        "tests/deps3", "parallel"};
+    for (const std::string& target : targets) {
+        parser->getPrereqs(target);
+    }
+    std::shared_ptr<const MakefileSnapshot> snapshot =
+        parser->snapshot(targets);
+
+    /* Many threads query the snapshot at once, and refresh file statuses
+     * while others read them, all without locking the snapshot. */
+    std::vector<std::string> expected =
+        std::get<0>(snapshot->expandRecipes("autoVars"));
+    std::atomic<int> mismatches = 0;
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 16; i++) {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 100; j++) {
+                    for (const std::string& target : targets) {
+                        snapshot->outdated(target);
+                        snapshot->modifiedTime(target);
+                        snapshot->refreshFileStatus(target);
+                    }
+                    if (std::get<0>(snapshot->expandRecipes("autoVars")) !=
+                        expected) {
+                        mismatches++;
+                    }
+                }
+            });
+        }
+    }
+    EXPECT_EQ(mismatches, 0);
+}
\ No newline at end of file
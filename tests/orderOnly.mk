@@ -0,0 +1,14 @@
+# Order-only prerequisites and phony targets. The output directory only has to
+# exist before the object is built, so adding a file to it does not rebuild the
+# object. The phony target is never looked up as a file, so a stray file named
+# after it does not make it up to date.
+.PHONY: tests/orderAll
+
+tests/orderAll: tests/orderDir/obj
+	@echo all done
+
+tests/orderDir/obj: tests/orderSrc | tests/orderDir
+	cp tests/orderSrc $|/obj
+
+tests/orderDir:
+	mkdir -p tests/orderDir
\ No newline at end of file
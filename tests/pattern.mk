@@ -0,0 +1,23 @@
+# Pattern rules. A target without recipes is matched against the pattern
+# rules by the text around the `%`, and the rule with the shortest stem wins.
+
+all: tests/pattern1.out tests/plain.out
+
+tests/%.out: tests/%.in
+	cat $< > $@
+	@echo $@ built from $< with stem $*
+
+# Preferred over tests/%.out for tests/pattern1.out since its stem is shorter.
+tests/pattern%.out: tests/pattern%.in
+	cat $^ > $@
+	@echo $@ built from $^ with stem $*
+
+# Chained with the rules above to create their prerequisites first.
+tests/%.in:
+	echo $* > $@
+
+# Without recipes, this adds a prerequisite to those of the pattern rule.
+tests/pattern1.out: tests/pattern.header
+
+tests/pattern.header:
+	echo header > $@
\ No newline at end of file
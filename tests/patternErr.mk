@@ -0,0 +1,3 @@
+# Error: either all targets of a rule are patterns or none are.
+tests/%.o tests/normal.o: tests/%.c
+	echo Output for mixed rule
\ No newline at end of file
@@ -0,0 +1,2 @@
+# Error: variables cannot be assigned to pattern targets.
+tests/%.o: CFLAGS = -g
\ No newline at end of file
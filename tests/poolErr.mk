@@ -0,0 +1,2 @@
+pool link 2
+.POOL.compile: a.o
\ No newline at end of file
@@ -0,0 +1,11 @@
+# Recursive make. A recipe that only runs $(MAKE) is run in-process, sharing
+# the jobs of this make.
+all: tests/submake/out
+	@cat tests/submake/out
+
+tests/submake/out:
+	@$(MAKE) -C tests/submake
+
+# Fails in the sub-make, which fails this target.
+fail:
+	@$(MAKE) -C tests/submake missing
\ No newline at end of file
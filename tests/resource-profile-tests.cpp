@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "dag-analysis.h"
+#include "resource-profile.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+TEST(ResourceProfile, add) {
+    ResourceProfile profile;
+    profile.add("a", {.wallSeconds = 1,
+                      .userSeconds = 0.5,
+                      .maxRssKilobytes = 100,
+                      .voluntarySwitches = 2});
+    profile.add("a", {.wallSeconds = 2,
+                      .userSeconds = 1,
+                      .maxRssKilobytes = 50,
+                      .involuntarySwitches = 1});
+    profile.add("b", {.wallSeconds = 0.5, .maxRssKilobytes = 300});
+
+    /* Times and switches add up, but memory is the peak of any recipe. */
+    ResourceUsage a = profile.getUsages()["a"];
+    EXPECT_EQ(a.wallSeconds, 3);
+    EXPECT_EQ(a.userSeconds, 1.5);
+    EXPECT_EQ(a.maxRssKilobytes, 100);
+    EXPECT_EQ(a.voluntarySwitches + a.involuntarySwitches, 3);
+
+    std::ostringstream top;
+    profile.writeTop(top, 1);
+    EXPECT_EQ(top.str(),
+              "slowest targets:\n"
+              "  a: 3s wall, 1.5s user, 0s system, 3 context switches\n"
+              "hungriest targets:\n"
+              "  b: 300 KB max RSS\n");
+}
+
+TEST(ResourceProfile, write) {
+    ResourceProfile profile;
+    profile.add("a", {.wallSeconds = 1.5, .maxRssKilobytes = 100});
+    profile.add("b\"", {.wallSeconds = 2});
+    profile.add("c,d\ne", {.wallSeconds = 3});
+
+    std::ostringstream json;
+    profile.writeJson(json);
+    EXPECT_NE(json.str().find("\"b\\\"\": {\"wall\": 2, "), std::string::npos);
+
+    /* An exported CSV can weight an analysis by wall time. Targets with
+     * commas, quotes or line breaks are quoted. */
+    std::ostringstream csv;
+    profile.writeCsv(csv);
+    EXPECT_NE(csv.str().find("\n\"b\"\"\",2,"), std::string::npos);
+    EXPECT_NE(csv.str().find("\n\"c,d\ne\",3,"), std::string::npos);
+    std::string path = "tests/profile.csv";
+    EXPECT_TRUE(profile.writeFile(path));
+    EXPECT_EQ(DagAnalysis::readDurations(path),
+              (std::map<std::string, double>(
+                  {{"a", 1.5}, {"b\"", 2}, {"c,d\ne", 3}})));
+    std::remove(path.c_str());
+
+    EXPECT_FALSE(profile.writeFile("tests/missing/profile.json"));
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+
+#include "restat-log.h"
+
+/* For file paths to work, please run test binary from project repo root
+ * directory. */
+
+TEST(RestatLog, record_erase) {
+    RestatLog log;
+    EXPECT_FALSE(log.builtAsOf("a").has_value());
+
+    log.record("a", {.tv_sec = 1, .tv_nsec = 2});
+    EXPECT_EQ(log.builtAsOf("a")->tv_sec, 1);
+    EXPECT_EQ(log.builtAsOf("a")->tv_nsec, 2);
+
+    log.erase("a");
+    EXPECT_FALSE(log.builtAsOf("a").has_value());
+}
+
+TEST(RestatLog, save_load) {
+    std::string path = "tests/restat.log";
+    RestatLog log;
+    log.record("a", {.tv_sec = 1, .tv_nsec = 2});
+    log.record("path with space", {.tv_sec = 3, .tv_nsec = 4});
+    log.save(path);
+
+    RestatLog loaded;
+    loaded.load(path);
+    EXPECT_EQ(loaded.times.size(), 2);
+    EXPECT_EQ(loaded.builtAsOf("path with space")->tv_sec, 3);
+    EXPECT_FALSE(loaded.changed);
+    std::remove(path.c_str());
+
+    /* A missing log is empty. */
+    loaded.load("tests/notpresent.log");
+    EXPECT_EQ(loaded.times.size(), 2);
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+# Early cutoff. The generator only rewrites its output when the output would
+# change, so its dependents are not rebuilt when it runs without changing it,
+# and it is not run again until its source changes again.
+.RESTAT: tests/genHeader
+
+tests/genHeader: tests/genSrc
+	cmp -s tests/genSrc tests/genHeader || cp tests/genSrc tests/genHeader
+
+tests/genOut: tests/genHeader
+	cp tests/genHeader tests/genOut
\ No newline at end of file
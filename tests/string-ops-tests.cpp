@@ -7,7 +7,20 @@ TEST(StringOps, trim) {
     EXPECT_EQ(StringOps::trim("  "), "");
 }
 
+TEST(StringOps, join) {
+    EXPECT_EQ(StringOps::join({"a", "b", "c"}, ' '), "a b c");
+    EXPECT_EQ(StringOps::join({"", "b"}, ' '), " b");
+    EXPECT_EQ(StringOps::join({}, ' '), "");
+}
+
 TEST(StringOps, split) {
     EXPECT_EQ(StringOps::split("  a   b      c    ", ' '),
               std::vector<std::string>({"a", "b", "c"}));
 }
+
+
+TEST(StringOps, csvField) {
+    EXPECT_EQ(StringOps::csvField("a b"), "a b");
+    EXPECT_EQ(StringOps::csvField("a,b"), "\"a,b\"");
+    EXPECT_EQ(StringOps::csvField("a\"b\n"), "\"a\"\"b\n\"");
+}
@@ -0,0 +1,18 @@
+# Target-specific variables. Each applies to the recipes of its target only,
+# and overrides the variable wherever it is referenced, even from a makefile
+# variable.
+CFLAGS = -O2
+COMPILE = cc $(CFLAGS)
+
+all: debug release
+
+debug: CFLAGS = -g
+debug: CFLAGS += -Wall
+debug:
+	@echo debug: $(COMPILE)
+
+release:
+	@echo release: $(COMPILE)
+
+# Assigned after the target-specific variables, yet still seen by them.
+CFLAGS := -O3
\ No newline at end of file
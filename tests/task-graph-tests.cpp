@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #include "task-graph.h"
 
 auto printTask = [](const std::string& task) {
@@ -100,4 +105,173 @@ TEST(TaskGraph, run_graph2) {
 
     std::cout << "****** NEW RUN ******\n";
     EXPECT_TRUE(TaskGraph::run(tasks, 10));
+}
+
+TEST(TaskGraph, run_pools) {
+    /* The number of tasks running in total and in the pool, and the most seen
+     * at once. */
+    std::atomic<int> running = 0;
+    std::atomic<int> runningInPool = 0;
+    std::atomic<int> maxRunning = 0;
+    std::atomic<int> maxRunningInPool = 0;
+    auto track = [](std::atomic<int>& count, std::atomic<int>& max) {
+        int now = ++count;
+        int seen = max;
+        while (now > seen && !max.compare_exchange_weak(seen, now)) {
+        }
+    };
+    auto pooledTask = [&](const std::string&) {
+        track(running, maxRunning);
+        track(runningInPool, maxRunningInPool);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        runningInPool--;
+        running--;
+        return true;
+    };
+    auto otherTask = [&](const std::string&) {
+        track(running, maxRunning);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        running--;
+        return true;
+    };
+
+    /* Tasks outside the pool run alongside the pooled tasks instead of
+     * waiting behind them. */
+    std::vector<TaskGraph::Task> tasks = {
+        {"link1", {}, pooledTask, "link"}, {"link2", {}, pooledTask, "link"},
+        {"link3", {}, pooledTask, "link"}, {"cc1", {}, otherTask},
+        {"cc2", {}, otherTask},            {"cc3", {}, otherTask},
+    };
+    EXPECT_TRUE(TaskGraph::run(tasks, 4, {{"link", 1}}));
+    EXPECT_EQ(maxRunningInPool, 1);
+    EXPECT_EQ(maxRunning, 4);
+
+    /* A pool without a depth is unlimited. */
+    maxRunningInPool = 0;
+    EXPECT_TRUE(TaskGraph::run(tasks, 4));
+    EXPECT_GT(maxRunningInPool, 1);
+}
+
+TEST(TaskGraph, run_pools_many) {
+    /* Many tasks waiting on a full pool each cost one launch, and start in
+     * the order they became ready. */
+    size_t numTasks = 50000;
+    std::vector<size_t> order;
+    auto startTask = [&](const std::string& task,
+                         std::function<void(bool)> finished) {
+        order.push_back(std::stoul(task));
+        finished(true);
+    };
+    std::vector<TaskGraph::Task> tasks(numTasks);
+    for (size_t i = 0; i < numTasks; i++) {
+        tasks[i].task = std::to_string(i);
+        tasks[i].startTask = startTask;
+        tasks[i].pool = "serial";
+    }
+
+    EXPECT_TRUE(TaskGraph::run(tasks, 4, {{"serial", 1}}));
+    ASSERT_EQ(order.size(), numTasks);
+    for (size_t i = 0; i < numTasks; i++) {
+        EXPECT_EQ(order[i], i);
+    }
+}
+
+TEST(TaskGraph, run_started) {
+    /* Started tasks finish on other threads, in any order. */
+    std::vector<std::string> order;
+    std::mutex orderMutex;
+    auto startTask = [&](const std::string& task,
+                         std::function<void(bool)> finished) {
+        std::thread([&, task, finished] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            {
+                std::lock_guard lock(orderMutex);
+                order.push_back(task);
+            }
+            finished(task != "fail");
+        }).detach();
+    };
+    std::vector<TaskGraph::Task> tasks = {
+        {.task = "3a", .startTask = startTask},
+        {.task = "3b", .startTask = startTask},
+        {.task = "2", .parentTasks = {"3a", "3b"}, .startTask = startTask},
+        {.task = "1", .parentTasks = {"2"}, .runTask = printTask}};
+    EXPECT_TRUE(TaskGraph::run(tasks, 2));
+    EXPECT_EQ(order.size(), 3);
+    EXPECT_EQ(order.back(), "2");
+
+    /* Tasks still running when one fails are waited for. */
+    order.clear();
+    tasks = {{.task = "fail", .startTask = startTask},
+             {.task = "other", .startTask = startTask},
+             {.task = "after",
+              .parentTasks = {"fail"},
+              .startTask = startTask}};
+    EXPECT_FALSE(TaskGraph::run(tasks, 2));
+    EXPECT_EQ(order.size(), 2);
+}
+
+TEST(TaskGraph, simulate) {
+    std::map<std::string, double> durations = {
+        {"a", 3}, {"b", 1}, {"c", 2}, {"d", 1}};
+    auto duration = [&](const std::string& task) {
+        return durations.at(task);
+    };
+    std::vector<TaskGraph::Task> tasks = {
+        {"a"}, {"b"}, {"c"}, {"d", {"a", "b", "c", "notpresent"}}, {"d"}};
+
+    TaskGraph::Simulation simulation = TaskGraph::simulate(tasks, 1, duration);
+    EXPECT_TRUE(simulation.complete);
+    EXPECT_EQ(simulation.numTasks, 4);
+    EXPECT_EQ(simulation.makespan, 7);
+    EXPECT_EQ(simulation.idleTime, 0);
+    EXPECT_EQ(simulation.utilization, 1);
+
+    /* `c` starts in the slot that `b` frees, and `d` once all three end. */
+    simulation = TaskGraph::simulate(tasks, 2, duration);
+    EXPECT_EQ(simulation.makespan, 4);
+    EXPECT_EQ(simulation.busyTime, 7);
+    EXPECT_EQ(simulation.idleTime, 1);
+    EXPECT_EQ(simulation.utilization, 7.0 / 8);
+
+    /* A pool of depth 1 runs its tasks one after another. */
+    for (TaskGraph::Task& task : tasks) {
+        task.pool = task.task == "d" ? "" : "serial";
+    }
+    simulation = TaskGraph::simulate(tasks, 3, duration, {{"serial", 1}});
+    EXPECT_EQ(simulation.makespan, 7);
+    EXPECT_EQ(simulation.idleTime, 14);
+
+    /* Tasks in a cycle never run. */
+    tasks = {{"x", {"y"}}, {"y", {"x"}}, {"z"}};
+    simulation = TaskGraph::simulate(
+        tasks, 2, [](const std::string&) { return 1.0; });
+    EXPECT_FALSE(simulation.complete);
+    EXPECT_EQ(simulation.numTasks, 1);
+}
+
+TEST(TaskGraph, simulate_layers) {
+    /* Layers of 100 tasks, each depending on the task below it and the first
+     * task of the layer before, take one time unit per layer given a slot per
+     * task of a layer. */
+    size_t numTasks = 100000;
+    size_t width = 100;
+    std::vector<TaskGraph::Task> tasks(numTasks);
+    for (size_t i = 0; i < numTasks; i++) {
+        tasks[i].task = std::to_string(i);
+        if (i >= width) {
+            tasks[i].parentTasks = {std::to_string(i - width),
+                                    std::to_string(i / width * width - width)};
+        }
+    }
+    auto duration = [](const std::string&) { return 1.0; };
+
+    TaskGraph::Simulation simulation =
+        TaskGraph::simulate(tasks, width, duration);
+    EXPECT_TRUE(simulation.complete);
+    EXPECT_EQ(simulation.makespan, numTasks / width);
+    EXPECT_EQ(simulation.utilization, 1);
+
+    simulation = TaskGraph::simulate(tasks, width / 2, duration);
+    EXPECT_EQ(simulation.makespan, 2 * numTasks / width);
 }
\ No newline at end of file
@@ -125,6 +125,85 @@ p2:
 p3:
 	for x in a b c; do sleep 0.5; echo p3$$x; done
 	
+# Test assignment operators: 'make assignOps'
+ASSIGN_BASE = before
+SIMPLE := $(ASSIGN_BASE) $$
+RECURSIVE = $(ASSIGN_BASE)
+ASSIGN_BASE = after
+COND ?= first
+COND ?= second
+APPEND = $(ASSIGN_BASE)
+APPEND += more
+SIMPLE += $(ASSIGN_BASE)
+assignOps:
+	echo $(SIMPLE) / $(RECURSIVE) / $(COND) / $(APPEND)
+
+# Keep rebuilding tests/watchOut whenever tests/watchSrc changes:
+# 'make --watch tests/watchOut'
+tests/watchOut: tests/watchSrc
+	cat tests/watchSrc > tests/watchOut
+
+tests/watchSrc:
+
+# Files written while tests/watchSlow builds trigger another build:
+# 'make --watch tests/watchSlow'
+tests/watchSlow: tests/watchSlowSrc
+	cp tests/watchSlowSrc tests/watchSlow; sleep 2
+
+tests/watchSlowSrc:
+
+# Shell functions run again in each rebuild:
+# 'make --watch tests/watchShell'
+tests/watchShell: tests/watchShellSrc
+	echo $(shell cat tests/watchShellSrc) > tests/watchShell
+
+tests/watchShellSrc:
+
+# Restore tests/cachedOut instead of building it once it is cached:
+# 'make --cache-dir=tests/cache tests/cachedOut'
+tests/cachedOut: tests/cachedSrc
+	cat tests/cachedSrc > tests/cachedOut
+
+tests/cachedSrc:
+
+# Run recipes on a worker started with
+# 'minimake-worker unix:tests/worker.sock':
+# 'make --remote=unix:tests/worker.sock -j 0 remote remoteErr'
+remote:
+	echo remote output
+	@echo $$((6 * 7))
+
+remoteErr:
+	exit 3
+
+# Build at most one of the heavy targets at a time: 'make -j 4 pooled'
+pool heavy 1
+.POOL.heavy: pooledA pooledB
+pooled: pooledA pooledB pooledC
+pooledA:
+	@echo A start; sleep 0.5; echo A end
+pooledB:
+	@echo B start; sleep 0.5; echo B end
+pooledC:
+	@sleep 0.2; echo C end
+
+# Pass the prerequisites through a response file: 'make tests/rspfile'
+tests/rspfile: tests/test.mk tests/empty.mk tests/comment.mk
+	$(file >$@.rsp,$^)
+	xargs -a $@.rsp ls > $@; cat $@
+
+# List files with functions instead of a script: 'make functions'
+MAKEFILES = $(sort $(wildcard tests/pattern*.mk tests/e*.mk))
+functions:
+	@echo $(patsubst tests/%.mk,%,$(MAKEFILES))
+	@echo $(subst tests/,,$(MAKEFILES))$(shell echo " from shell")
+
+# Each shard builds its part of these at once: 'make -j 4 --shard=1/2 wide'
+wide: w1 w2 w3 w4
+
+w1 w2 w3 w4:
+	@sleep 1
+
 # Cleans up any modifications made during tests.
 clean:
-	rm -f tests/basic2 tests/deps*
\ No newline at end of file
+	rm -rf tests/basic2 tests/deps* tests/watch* tests/cache* tests/worker* tests/rspfile*
\ No newline at end of file
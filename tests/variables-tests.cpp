@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#include <filesystem>
+#include <fstream>
+
 #include "makefile-parser.h"
 #include "variables.h"
 
@@ -36,6 +39,141 @@ TEST(Variables, expandVariables) {
     EXPECT_EQ(output, "$");
 }
 
+TEST(Variables, flavors) {
+    Variables vars;
+    vars.addVariable("$", "$", 0);
+    vars.addVariable("A", "a", 0);
+    vars.addVariable("S", vars.expandVariables("$(A)$$(A)", 0), 0,
+                     Variables::Flavor::Simple);
+    vars.addVariable("R", "$(A)", 0);
+    vars.addVariable("A", "b", 0);
+
+    /* A simple value is not expanded again. */
+    EXPECT_EQ(vars.expandVariables("$(S)", 0), "a$(A)");
+    EXPECT_EQ(vars.expandVariables("$(R)", 0), "b");
+
+    /* Appending keeps the flavor. */
+    vars.appendVariable("S", "$(A)", 0);
+    vars.appendVariable("R", "$(A)", 0);
+    EXPECT_EQ(vars.variables["S"], "a$(A) b");
+    EXPECT_EQ(vars.variables["R"], "$(A) $(A)");
+
+    /* Referencing an undefined variable does not define it. */
+    EXPECT_EQ(vars.expandVariables("$(U)", 0), "");
+    EXPECT_FALSE(vars.defined("U"));
+    vars.appendVariable("U", "u", 0);
+    EXPECT_EQ(vars.expandVariables("$(U)", 0), "u");
+}
+
+TEST(Variables, nested) {
+    Variables vars;
+    vars.addVariable("NAME", "A", 0);
+    vars.addVariable("A", "a", 0);
+    EXPECT_EQ(vars.expandVariables("$($(NAME))-$(A)", 0), "a-a");
+    EXPECT_THROW(vars.expandVariables("$($(NAME)", 0),
+                 Variables::VariablesException);
+}
+
+TEST(Variables, automaticVariables) {
+    Variables vars;
+    vars.addVariable("@", "stored", 0);
+    vars.addVariable("R", "$@", 0);
+
+    /* Automatic variables take precedence and are not expanded further. */
+    std::map<std::string, std::string> autovars = {{"@", "t"}, {"^", "$(R)"}};
+    EXPECT_EQ(vars.expandVariables("$@ $(R) $^", 0, autovars), "t t $(R)");
+    EXPECT_EQ(vars.expandVariables("$@", 0), "stored");
+}
+
+TEST(Variables, scopes) {
+    Variables global;
+    global.addVariable("CFLAGS", "-O2", 0);
+    global.addVariable("CC", "cc $(CFLAGS)", 0);
+    global.addVariable("S", "s", 0, Variables::Flavor::Simple);
+
+    /* A scope only holds its own variables, and overrides those referenced
+     * by the enclosing scope's values. */
+    Variables target(&global);
+    target.addVariable("CFLAGS", "-g", 0);
+    EXPECT_EQ(target.variables.size(), 1);
+    EXPECT_EQ(target.expandVariables("$(CC)", 0), "cc -g");
+    EXPECT_EQ(global.expandVariables("$(CC)", 0), "cc -O2");
+    EXPECT_TRUE(target.defined("S"));
+
+    /* Appending to an enclosing variable leaves it unchanged. */
+    target.appendVariable("S", "$(CFLAGS)", 0);
+    EXPECT_EQ(target.expandVariables("$(S)", 0), "s -g");
+    EXPECT_EQ(global.expandVariables("$(S)", 0), "s");
+}
+
+TEST(Variables, fileFunction) {
+    std::string path = "tests/fileFunction.rsp";
+    Variables vars;
+    vars.addVariable("PATH", path, 0);
+    vars.addVariable("LIST", "a, b (c)", 0);
+
+    EXPECT_EQ(vars.expandVariables("[$(file >$(PATH),$(LIST))]", 0), "[]");
+    EXPECT_EQ(vars.expandVariables("$(file >>$(PATH),more)", 0), "");
+    EXPECT_EQ(vars.expandVariables("$(file <$(PATH))", 0), "a, b (c)\nmore");
+    EXPECT_EQ(vars.expandVariables("$(file > $(PATH))$(file <$(PATH))", 0),
+              "");
+
+    EXPECT_THROW(vars.expandVariables("$(file $(PATH))", 0),
+                 Variables::VariablesException);
+    EXPECT_THROW(vars.expandVariables("$(file <tests/notpresent.file)", 0),
+                 Variables::VariablesException);
+    std::remove(path.c_str());
+}
+
+TEST(Variables, functions) {
+    Variables vars;
+    vars.addVariable("SRCS", "a.c b.c  dir/c.c d.h", 0);
+    EXPECT_EQ(vars.expandVariables("$(patsubst %.c,%.o,$(SRCS))", 0),
+              "a.o b.o dir/c.o d.h");
+    EXPECT_EQ(vars.expandVariables("$(patsubst d.h, e.h ,$(SRCS))", 0),
+              "a.c b.c dir/c.c e.h");
+    EXPECT_EQ(vars.expandVariables("$(subst .c,.cc,$(SRCS))", 0),
+              "a.cc b.cc  dir/c.cc d.h");
+    EXPECT_EQ(vars.expandVariables("$(subst $(SRCS),x,y,$(SRCS))", 0), "y,x");
+    EXPECT_EQ(vars.expandVariables("$(sort b a c a)", 0), "a b c");
+    EXPECT_THROW(vars.expandVariables("$(subst a,b)", 0),
+                 Variables::VariablesException);
+
+    /* Names in a directory are matched after it was scanned once, so files
+     * added later in the run are not found. */
+    std::filesystem::create_directories("tests/wildcard/sub");
+    for (const char* file : {"tests/wildcard/b.c", "tests/wildcard/a.c",
+                             "tests/wildcard/.hidden.c",
+                             "tests/wildcard/sub/c.c"}) {
+        std::ofstream{file};
+    }
+    EXPECT_EQ(vars.expandVariables("$(wildcard tests/wildcard/*.c)", 0),
+              "tests/wildcard/a.c tests/wildcard/b.c");
+    EXPECT_EQ(vars.expandVariables(
+                  "$(wildcard tests/wildcard/*/*.c tests/wildcard/a.[ch])", 0),
+              "tests/wildcard/sub/c.c tests/wildcard/a.c");
+    EXPECT_EQ(vars.expandVariables("$(wildcard tests/wildcard/x.c)", 0), "");
+    std::ofstream{"tests/wildcard/x.c"};
+    EXPECT_EQ(vars.expandVariables("$(wildcard tests/wildcard/x.c)", 0), "");
+
+    /* A command is run once, however often a variable calls it. */
+    vars.addVariable("COUNT", "$(shell echo x >> tests/wildcard/count; "
+                              "wc -l < tests/wildcard/count; echo)", 0);
+    EXPECT_EQ(vars.expandVariables("$(COUNT) $(COUNT)", 0), "1 1");
+    EXPECT_EQ(vars.expandVariables("$(shell printf 'a\\nb')", 0), "a b");
+
+    /* Target scopes share the cache of the makefile's scope. */
+    Variables target(&vars);
+    EXPECT_EQ(target.expandVariables("$(COUNT)", 0), "1");
+
+    /* Once cleared, the functions look again. */
+    vars.clearFunctionCache();
+    EXPECT_EQ(target.expandVariables("$(COUNT)", 0), "2");
+    EXPECT_EQ(vars.expandVariables("$(wildcard tests/wildcard/x.c)", 0),
+              "tests/wildcard/x.c");
+    std::filesystem::remove_all("tests/wildcard");
+}
+
 TEST(MakefileParser, substituteVariables_detectLoop) {
     Variables vars;
     vars.variables = {{"A", "$(B)"}, {"B", "$(C)"}, {"C", "$(A)"}};